@@ -0,0 +1,414 @@
+/****************************************************************
+ 
+    batch.c - Simulated War
+ 
+ =============================================================
+
+ Copyright 1996-2025 Tom Barbalet. All rights reserved.
+
+ Permission is hereby granted, free of charge, to any person
+ obtaining a copy of this software and associated documentation
+ files (the "Software"), to deal in the Software without
+ restriction, including without limitation the rights to use,
+ copy, modify, merge, publish, distribute, sublicense, and/or
+ sell copies of the Software, and to permit persons to whom the
+ Software is furnished to do so, subject to the following
+ conditions:
+
+ The above copyright notice and this permission notice shall be
+ included in all copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ OTHER DEALINGS IN THE SOFTWARE.
+
+ This software is a continuing work of Tom Barbalet, begun on
+ 13 June 1996. No apes or cats were harmed in the writing of
+ this software.
+
+ ****************************************************************/
+
+
+/* Runs battles back to back without drawing and prints a line of results
+   for each, for use on machines without the Mac front end.
+
+   batch [-e] [-f] [-p profile] [-u] [-j threads] [-w width] <scenario.json> <seeds> <ticks>
+
+   seeds is a comma separated list of seeds and inclusive ranges, for
+   example 1,5,10-20. Each battle stops when it is decided, when neither
+   side moves, or after ticks cycles.
+
+   -e runs the seeds as an ensemble. The battles run BATCH_ROUND at a time
+   spread over the threads given by -j, each in its own battle, and their
+   results are added in seed order to running statistics printed at the
+   end. With -w the ensemble stops after the first round where the 95%
+   confidence interval of the alignment 0 win rate is no wider than width.
+   Rounds are a fixed size so the results do not depend on the threads.
+
+   -f fast forwards each battle over the cycles where no unit can reach the
+   unit it attacks, see engine_fast_forward. The results then differ from
+   stepping through every cycle. The cycles passed over are reported at the
+   end.
+
+   -p times each phase of every cycle and writes the times to the profile
+   file, JSON when its name ends in .json and CSV otherwise, see
+   engine_profile_write. -u adds each unit's share of the phases. The
+   battles are profiled when run in sequence, not as an ensemble. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include "toolkit.h"
+#include "battle.h"
+
+#define BATCH_ROUND      (32)
+#define BATCH_HISTOGRAM  (20)
+#define BATCH_Z          (1.959964)
+
+// The seeds still to run from a seed list
+typedef struct {
+    n_string location;
+    n_uint   next;
+    n_uint   last;
+    n_byte   within_range;
+} batch_seed_list;
+
+// A battle and its results
+typedef struct {
+    n_battle battle;
+    n_uint   seed;
+    n_int    ticks;
+    n_byte   fast_forward;
+    n_int    finished;
+    n_int    cycles;
+    n_uint   living[2];
+} batch_run;
+
+// Running statistics over the ensemble, Welford's method for the moments
+typedef struct {
+    n_uint   runs;
+    n_uint   wins[2];
+    n_double mean[3];
+    n_double sum_squares[3];
+    n_uint   histogram[BATCH_HISTOGRAM];
+} batch_statistics;
+
+// Take the next seed from the list, returns 1 for a seed, 0 at the end and -1 on error
+static n_int batch_seed_next(batch_seed_list *list, n_uint *seed) {
+    n_string end;
+
+    if (list->within_range) {
+        *seed = list->next;
+        if (list->next == list->last) {
+            list->within_range = 0;
+        } else {
+            list->next++;
+        }
+        return 1;
+    }
+    if (*list->location == 0) {
+        return 0;
+    }
+    list->next = strtoul(list->location, &end, 10);
+    list->last = list->next;
+    if (end == list->location) {
+        return SHOW_ERROR("Seed list not understood");
+    }
+    if (*end == '-') {
+        n_string first_end = end + 1;
+        list->last = strtoul(first_end, &end, 10);
+        if ((end == first_end) || (list->last < list->next)) {
+            return SHOW_ERROR("Seed range not understood");
+        }
+    }
+    if ((*end != ',') && (*end != 0)) {
+        return SHOW_ERROR("Seed list not understood");
+    }
+    list->location = (*end == ',') ? (end + 1) : end;
+    list->within_range = 1;
+    return batch_seed_next(list, seed);
+}
+
+// The winning alignment, or -1 when both or neither side survive
+static n_int batch_winner(batch_run *run) {
+    if ((run->living[0] != 0) && (run->living[1] == 0)) {
+        return 0;
+    }
+    if ((run->living[1] != 0) && (run->living[0] == 0)) {
+        return 1;
+    }
+    return -1;
+}
+
+// Run a started battle to its end or the tick cap
+static n_int batch_run_battle(void *general_data, void *read_data, void *write_data) {
+    batch_run *run = (batch_run *)read_data;
+    n_int loop = 0;
+
+    run->finished = 0;
+    while (loop < run->ticks) {
+        if (engine_update(&run->battle)) {
+            run->finished = 1;
+            break;
+        }
+        loop++;
+        if (run->fast_forward) {
+            loop += (n_int)engine_fast_forward(&run->battle, (n_uint)(run->ticks - loop));
+        }
+    }
+    run->cycles = engine_score(&run->battle, run->living);
+    return 0;
+}
+
+// Print a battle's line of results
+static void batch_print(batch_run *run) {
+    printf("%lu,%ld,%ld,%lu,%lu,%ld\n", run->seed, run->cycles, run->finished,
+           run->living[0], run->living[1], batch_winner(run));
+}
+
+// The cycles covered by each bar of the histogram, wide enough to hold the tick cap
+static n_int batch_bin_width(n_int ticks) {
+    return (ticks + BATCH_HISTOGRAM) / BATCH_HISTOGRAM;
+}
+
+// Add a battle's results to the statistics
+static void batch_statistics_add(batch_statistics *stats, batch_run *run) {
+    n_double values[3];
+    n_int winner = batch_winner(run);
+    n_int bin = run->cycles / batch_bin_width(run->ticks);
+    n_int loop = 0;
+
+    values[0] = (n_double)run->living[0];
+    values[1] = (n_double)run->living[1];
+    values[2] = (n_double)run->cycles;
+
+    stats->runs++;
+    if (winner != -1) {
+        stats->wins[winner]++;
+    }
+    while (loop < 3) {
+        n_double delta = values[loop] - stats->mean[loop];
+        stats->mean[loop] += delta / (n_double)stats->runs;
+        stats->sum_squares[loop] += delta * (values[loop] - stats->mean[loop]);
+        loop++;
+    }
+    stats->histogram[bin]++;
+}
+
+// The Wilson score interval of the alignment 0 win rate
+static void batch_win_interval(batch_statistics *stats, n_double *low, n_double *high) {
+    n_double runs = (n_double)stats->runs;
+    n_double rate = (n_double)stats->wins[0] / runs;
+    n_double z_squared = BATCH_Z * BATCH_Z;
+    n_double denominator = 1.0 + (z_squared / runs);
+    n_double centre = (rate + (z_squared / (2.0 * runs))) / denominator;
+    n_double half = (BATCH_Z * sqrt(((rate * (1.0 - rate)) / runs) + (z_squared / (4.0 * runs * runs)))) / denominator;
+
+    *low = centre - half;
+    *high = centre + half;
+}
+
+// The sample variance of one of the statistics
+static n_double batch_variance(batch_statistics *stats, n_int value) {
+    return (stats->runs > 1) ? (stats->sum_squares[value] / (n_double)(stats->runs - 1)) : 0.0;
+}
+
+// Print the statistics of the ensemble
+static void batch_statistics_print(batch_statistics *stats, n_int ticks) {
+    n_double low = 0.0, high = 0.0;
+    n_int loop = 0;
+
+    if (stats->runs == 0) {
+        return;
+    }
+    batch_win_interval(stats, &low, &high);
+
+    printf("ensemble,runs,%lu\n", stats->runs);
+    printf("ensemble,wins,%lu,%lu,%lu\n", stats->wins[0], stats->wins[1],
+           stats->runs - stats->wins[0] - stats->wins[1]);
+    printf("ensemble,win_rate0,%.6f,%.6f,%.6f\n", (n_double)stats->wins[0] / (n_double)stats->runs, low, high);
+    printf("ensemble,living0,%.3f,%.3f\n", stats->mean[0], batch_variance(stats, 0));
+    printf("ensemble,living1,%.3f,%.3f\n", stats->mean[1], batch_variance(stats, 1));
+    printf("ensemble,cycles,%.3f,%.3f\n", stats->mean[2], batch_variance(stats, 2));
+    printf("ensemble,histogram,%ld", batch_bin_width(ticks));
+    while (loop < BATCH_HISTOGRAM) {
+        printf(",%lu", stats->histogram[loop++]);
+    }
+    printf("\n");
+}
+
+// Run the seeds one after the other in a single battle
+static n_int batch_sequence(batch_run *run, n_file *file_json, batch_seed_list *list, n_int *cycles, n_int *skipped) {
+    n_int battles = 0;
+    n_int result;
+
+    while ((result = batch_seed_next(list, &run->seed)) == 1) {
+        if (engine_start(&run->battle, file_json, run->seed) != 0) {
+            return SHOW_ERROR("Battle conditions failed");
+        }
+        (void)batch_run_battle(NOTHING, run, NOTHING);
+        batch_print(run);
+        *cycles += run->cycles;
+        *skipped += (n_int)run->battle.skipped;
+        battles++;
+    }
+    return (result < 0) ? -1 : battles;
+}
+
+// Run the seeds a round at a time over the threads, adding each to the statistics
+static n_int batch_ensemble(batch_run *runs, n_file *file_json, batch_seed_list *list, n_int threads, n_double width, n_int *cycles, n_int *skipped) {
+    batch_statistics stats;
+    n_int battles = 0;
+    n_int result = 1;
+
+    memory_erase((n_byte *)&stats, sizeof(stats));
+    execute_threads(threads);
+
+    while (result == 1) {
+        n_int count = 0;
+        n_int loop = 0;
+
+        // The conditions are read one battle at a time as the JSON reader is not re-entrant
+        while ((count < BATCH_ROUND) && ((result = batch_seed_next(list, &runs[count].seed)) == 1)) {
+            if (engine_start(&runs[count].battle, file_json, runs[count].seed) != 0) {
+                return SHOW_ERROR("Battle conditions failed");
+            }
+            // The battles already fill the threads
+            runs[count].battle.game_vars.threads = 1;
+            count++;
+        }
+        if (result < 0) {
+            return -1;
+        }
+
+        execute_group(&batch_run_battle, NOTHING, runs, count, sizeof(batch_run));
+
+        while (loop < count) {
+            batch_print(&runs[loop]);
+            batch_statistics_add(&stats, &runs[loop]);
+            *cycles += runs[loop].cycles;
+            *skipped += (n_int)runs[loop].battle.skipped;
+            loop++;
+        }
+        battles += count;
+
+        if ((width > 0.0) && (stats.runs > 0)) {
+            n_double low, high;
+            batch_win_interval(&stats, &low, &high);
+            if ((high - low) <= width) {
+                break;
+            }
+        }
+    }
+    batch_statistics_print(&stats, runs[0].ticks);
+    return battles;
+}
+
+int main(int argc, char *argv[]) {
+    static batch_run runs[BATCH_ROUND];
+    batch_seed_list list;
+    n_file *file_json;
+    n_int ticks, battles, cycles = 0, skipped = 0;
+    n_int ensemble = 0, fast_forward = 0, threads = 1, profile_units = 0;
+    n_string profile = NOTHING;
+    n_double width = 0.0;
+    n_int argument = 1;
+    n_int loop = 0;
+    n_int run_count;
+    struct timespec start, end;
+
+    while ((argument < argc) && (argv[argument][0] == '-')) {
+        if (strcmp(argv[argument], "-e") == 0) {
+            ensemble = 1;
+        } else if (strcmp(argv[argument], "-f") == 0) {
+            fast_forward = 1;
+        } else if ((strcmp(argv[argument], "-p") == 0) && (argument + 1 < argc)) {
+            profile = argv[++argument];
+        } else if (strcmp(argv[argument], "-u") == 0) {
+            profile_units = 1;
+        } else if ((strcmp(argv[argument], "-j") == 0) && (argument + 1 < argc)) {
+            threads = strtol(argv[++argument], NOTHING, 10);
+        } else if ((strcmp(argv[argument], "-w") == 0) && (argument + 1 < argc)) {
+            width = strtod(argv[++argument], NOTHING);
+        } else {
+            break;
+        }
+        argument++;
+    }
+
+    if ((argc - argument) != 3) {
+        fprintf(stderr, "usage: %s [-e] [-f] [-p profile] [-u] [-j threads] [-w width] <scenario.json> <seeds> <ticks>\n", argv[0]);
+        return 1;
+    }
+
+    ticks = strtol(argv[argument + 2], NOTHING, 10);
+    if (ticks < 1) {
+        fprintf(stderr, "ticks must be one or more\n");
+        return 1;
+    }
+    if ((threads < 1) || (threads > EXECUTE_THREADS_MAX)) {
+        fprintf(stderr, "threads must be from 1 to %d\n", EXECUTE_THREADS_MAX);
+        return 1;
+    }
+    if (profile && ensemble) {
+        fprintf(stderr, "profiles are of battles run in sequence\n");
+        return 1;
+    }
+
+    run_count = ensemble ? BATCH_ROUND : 1;
+    while (loop < run_count) {
+        runs[loop].battle.quiet = 1;
+        runs[loop].ticks = ticks;
+        runs[loop].fast_forward = (n_byte)fast_forward;
+        (void)engine_init(&runs[loop].battle, 0);
+        loop++;
+    }
+    if (profile && (engine_profile(&runs[0].battle, 1, (n_byte)profile_units) != 0)) {
+        engine_exit(&runs[0].battle);
+        return 1;
+    }
+
+    file_json = engine_conditions_file(&runs[0].battle, argv[argument]);
+    if (file_json == NOTHING) {
+        fprintf(stderr, "%s not read\n", argv[argument]);
+        battles = -1;
+    } else {
+        memory_erase((n_byte *)&list, sizeof(list));
+        list.location = argv[argument + 1];
+
+        printf("seed,cycles,finished,living0,living1,winner\n");
+
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        if (ensemble) {
+            battles = batch_ensemble(runs, file_json, &list, threads, width, &cycles, &skipped);
+        } else {
+            battles = batch_sequence(runs, file_json, &list, &cycles, &skipped);
+        }
+        clock_gettime(CLOCK_MONOTONIC, &end);
+
+        fprintf(stderr, "%ld battles, %ld cycles, %.3f seconds\n", battles, cycles,
+                (double)(end.tv_sec - start.tv_sec) + ((double)(end.tv_nsec - start.tv_nsec) / 1e9));
+        if (fast_forward) {
+            fprintf(stderr, "%ld cycles fast forwarded\n", skipped);
+        }
+        if (profile && (battles > 0) && (engine_profile_write(&runs[0].battle, profile) == 0)) {
+            fprintf(stderr, "%s written\n", profile);
+        }
+        io_file_free(&file_json);
+    }
+
+    loop = 0;
+    while (loop < run_count) {
+        engine_exit(&runs[loop].battle);
+        loop++;
+    }
+    execute_close();
+    return (battles < 0) ? 1 : 0;
+}
@@ -0,0 +1,346 @@
+/****************************************************************
+ 
+    bench.c - Simulated War
+ 
+ =============================================================
+
+ Copyright 1996-2025 Tom Barbalet. All rights reserved.
+
+ Permission is hereby granted, free of charge, to any person
+ obtaining a copy of this software and associated documentation
+ files (the "Software"), to deal in the Software without
+ restriction, including without limitation the rights to use,
+ copy, modify, merge, publish, distribute, sublicense, and/or
+ sell copies of the Software, and to permit persons to whom the
+ Software is furnished to do so, subject to the following
+ conditions:
+
+ The above copyright notice and this permission notice shall be
+ included in all copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ OTHER DEALINGS IN THE SOFTWARE.
+
+ This software is a continuing work of Tom Barbalet, begun on
+ 13 June 1996. No apes or cats were harmed in the writing of
+ this software.
+
+ ****************************************************************/
+
+
+
+/* Generates battles of a given size and times a fixed number of cycles of
+   each, printing a line of results per size, for measuring how the engine
+   scales.
+
+   bench [-c combatants] [-u units] [-d density] [-m mix] [-t ticks] [-s seed] [-j threads] [-M move] [-S sort]
+
+   -c is a comma separated list of the combatants in each battle, both sides
+   together, 1000,10000,100000,1000000 by default. -u gives the units on each
+   side, by default one for every BENCH_UNIT_COMBATANTS. -d is the density of
+   each side's deployment, in combatants per board cell, 0.25 by default.
+   -m weighs the four unit types of bench_types, 1,1,1,1 by default, the
+   first being the only one with missiles. -t is the cycles timed, 100 by
+   default, and -s the random seed. -j spreads the phases over threads and
+   -M sets the move_method, 1 for MOVE_PROPOSE or 2 for MOVE_CONCURRENT, both
+   of which move in parallel too. Comparing -M 0 and -M 2 with -j 8 or -j 16
+   compares the serial board with the compare and swap board. -S sets the
+   sort_interval, putting the combatants in Z-order every so many cycles,
+   and comparing it with -S 0 shows what locality does for the phases.
+
+   Each side deploys in a rectangle on its half of the board, facing the
+   other, with its units on a grid within it. Sizes needing more room than
+   the board has are reported and passed over. Combatants landing on a cell
+   already taken are not placed, placed gives those that were.
+
+   The results are the combatants asked for and placed, the units on each
+   side, the cycles run and the seconds they took, the cycles a second, the
+   engine memory used and then, for each phase the profiler times, the
+   nanoseconds per combatant placed per cycle. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include "toolkit.h"
+#include "battle.h"
+
+#define BENCH_TYPES             (4)
+#define BENCH_SIZES             (16)
+#define BENCH_UNIT_COMBATANTS   (500)
+#define BENCH_SIDE_GAP          (40)   /* cells from the centre line to each side */
+#define BENCH_MARGIN            (24)   /* cells kept clear around the board edge */
+
+static const n_string_block bench_types =
+    "\"unit_types\":["
+        "{\"defence\":4,\"melee_attack\":6,\"melee_damage\":3,\"melee_armpie\":1,"
+        "\"missile_attack\":3,\"missile_damage\":4,\"missile_armpie\":1,\"missile_rate\":100,\"missile_range\":40,"
+        "\"speed_maximum\":3,\"stature\":4,\"leadership\":2,\"wounds_per_combatant\":3,\"type_id\":0,\"formation\":3},"
+        "{\"defence\":2,\"melee_attack\":3,\"melee_damage\":1,\"melee_armpie\":1,"
+        "\"missile_attack\":0,\"missile_damage\":0,\"missile_armpie\":0,\"missile_rate\":0,\"missile_range\":0,"
+        "\"speed_maximum\":4,\"stature\":1,\"leadership\":2,\"wounds_per_combatant\":2,\"type_id\":1,\"formation\":2},"
+        "{\"defence\":4,\"melee_attack\":6,\"melee_damage\":2,\"melee_armpie\":2,"
+        "\"missile_attack\":0,\"missile_damage\":0,\"missile_armpie\":0,\"missile_rate\":0,\"missile_range\":0,"
+        "\"speed_maximum\":6,\"stature\":2,\"leadership\":4,\"wounds_per_combatant\":3,\"type_id\":2,\"formation\":1},"
+        "{\"defence\":2,\"melee_attack\":7,\"melee_damage\":1,\"melee_armpie\":3,"
+        "\"missile_attack\":0,\"missile_damage\":0,\"missile_armpie\":0,\"missile_rate\":0,\"missile_range\":0,"
+        "\"speed_maximum\":7,\"stature\":2,\"leadership\":3,\"wounds_per_combatant\":1,\"type_id\":3,\"formation\":3}"
+    "]";
+
+// What to generate
+typedef struct {
+    n_uint   combatants;
+    n_uint   units;
+    n_double density;
+    n_uint   mix[BENCH_TYPES];
+    n_uint   threads;
+    n_uint   move_method;
+    n_uint   sort_interval;
+} bench_scenario;
+
+// Read a comma separated list of up to most numbers, returns how many or -1 on error
+static n_int bench_list(n_string location, n_uint *values, n_int most) {
+    n_int count = 0;
+    while (*location != 0) {
+        n_string end;
+        if (count == most) {
+            return -1;
+        }
+        values[count] = strtoul(location, &end, 10);
+        if ((end == location) || ((*end != ',') && (*end != 0))) {
+            return -1;
+        }
+        count++;
+        location = (*end == ',') ? (end + 1) : end;
+    }
+    return count;
+}
+
+// The unit type at a place in a side's units, spreading the types by their weights
+static n_uint bench_type(bench_scenario *scenario, n_uint unit, n_uint units) {
+    n_uint total = 0, position, loop = 0;
+    while (loop < BENCH_TYPES) {
+        total += scenario->mix[loop++];
+    }
+    position = (((unit * 2) + 1) * total) / (units * 2);
+    loop = 0;
+    while (loop < (BENCH_TYPES - 1)) {
+        if (position < scenario->mix[loop]) {
+            break;
+        }
+        position -= scenario->mix[loop];
+        loop++;
+    }
+    return loop;
+}
+
+// Write the scenario as battle JSON, returns NOTHING when it does not fit the board
+static n_file *bench_generate(bench_scenario *scenario) {
+    n_uint units = scenario->units;
+    n_double area, region_width, region_height;
+    n_uint grid_rows, grid_columns;
+    n_string_block line;
+    n_file *file;
+    n_int side = 0;
+
+    if (units == 0) {
+        units = (scenario->combatants + (2 * BENCH_UNIT_COMBATANTS) - 1) / (2 * BENCH_UNIT_COMBATANTS);
+    }
+    if (((scenario->combatants + 1) / 2) > (units * (n_uint)NUNIT_NO_ATTACK)) {
+        return NOTHING;
+    }
+    area = ((n_double)scenario->combatants / 2.0) / scenario->density;
+    region_height = BATTLE_BOARD_HEIGHT - (2 * BENCH_MARGIN);
+    region_width = area / region_height;
+    if (region_width < region_height) {
+        region_height = sqrt(area);
+        region_width = region_height;
+    }
+    if (region_width > ((BATTLE_BOARD_WIDTH / 2) - BENCH_SIDE_GAP - BENCH_MARGIN)) {
+        return NOTHING;
+    }
+    grid_rows = (n_uint)ceil(sqrt((n_double)units * region_height / region_width));
+    grid_columns = (units + grid_rows - 1) / grid_rows;
+
+    file = io_file_new();
+    if (file == NOTHING) {
+        return NOTHING;
+    }
+    sprintf(line, "{\"general_variables\":{\"attack_melee_dsq\":5,\"declare_group_facing_dsq\":8000,"
+            "\"declare_max_start_dsq\":65535,\"declare_one_to_one_dsq\":65535,\"declare_close_enough_dsq\":5,"
+            "\"threads\":%lu,\"move_method\":%lu,\"sort_interval\":%lu},", scenario->threads, scenario->move_method,
+            scenario->sort_interval);
+    (void)io_write(file, line, 0);
+    (void)io_write(file, bench_types, 0);
+    (void)io_write(file, ",\"units\":[", 0);
+
+    while (side < 2) {
+        n_uint side_combatants = (side == 0) ? (scenario->combatants - (scenario->combatants / 2)) : (scenario->combatants / 2);
+        n_double cell_width = region_width / (n_double)grid_columns;
+        n_double cell_height = region_height / (n_double)grid_rows;
+        n_uint unit = 0;
+        while (unit < units) {
+            n_uint type = bench_type(scenario, unit, units);
+            n_uint number = (side_combatants / units) + ((unit < (side_combatants % units)) ? 1 : 0);
+            n_uint width = (n_uint)sqrt((n_double)number * cell_height / cell_width);
+            n_double depth = ((n_double)(unit / grid_rows) + 0.5) * cell_width;
+            n_int x = (side == 0) ? (n_int)((BATTLE_BOARD_WIDTH / 2) - BENCH_SIDE_GAP - depth) : (n_int)((BATTLE_BOARD_WIDTH / 2) + BENCH_SIDE_GAP + depth);
+            n_int y = (n_int)(((BATTLE_BOARD_HEIGHT - region_height) / 2.0) + (((n_double)(unit % grid_rows) + 0.5) * cell_height));
+
+            if (number == 0) {
+                unit++;
+                continue;
+            }
+            width = (width < 1) ? 1 : ((width > number) ? number : width);
+            sprintf(line, "%s{\"type_id\":%lu,\"width\":%lu,\"average\":[%ld,%ld],\"angle\":%d,"
+                    "\"number_combatants\":%lu,\"alignment\":%ld,\"missile_number\":%d}",
+                    ((side + unit) == 0) ? "" : ",", type, width, x, y, (side == 0) ? 128 : 0,
+                    number, side, (type == 0) ? 20 : 0);
+            (void)io_write(file, line, 0);
+            unit++;
+        }
+        side++;
+    }
+    (void)io_write(file, "]}", 0);
+    // The JSON reader expects the unused part of the file to be empty, as from a disk read
+    memory_erase(&file->data[file->location], file->size - file->location);
+    scenario->units = units;
+    return file;
+}
+
+// The combatants placed on the board
+static n_uint bench_placed(n_battle *battle) {
+    n_uint count[2];
+    (void)engine_score(battle, count);
+    return count[0] + count[1];
+}
+
+// Generate, run and time one size, returns -1 on error
+static n_int bench_run(n_battle *battle, bench_scenario *scenario, n_int ticks, n_uint seed) {
+    static const n_profile_phase phases[] = {PROFILE_OPPONENT, PROFILE_SORT, PROFILE_MOVE, PROFILE_GRID, PROFILE_DECLARE,
+                                             PROFILE_ATTACK, PROFILE_REMOVE_DEAD, PROFILE_FORMATION, PROFILE_CYCLE};
+    n_uint asked_units = scenario->units;
+    n_file *file_json = bench_generate(scenario);
+    struct timespec start, end;
+    n_double seconds, cycle_combatants;
+    n_uint placed;
+    n_int cycles = 0;
+    n_uint loop = 0;
+
+    if (file_json == NOTHING) {
+        printf("%lu,does not fit the board\n", scenario->combatants);
+        return 0;
+    }
+    if (engine_start(battle, file_json, seed) != 0) {
+        io_file_free(&file_json);
+        return SHOW_ERROR("Battle conditions failed");
+    }
+    io_file_free(&file_json);
+    placed = bench_placed(battle);
+
+    if (engine_profile(battle, 1, 0) != 0) {
+        return -1;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    while (cycles < ticks) {
+        if (engine_update(battle)) {
+            break;
+        }
+        cycles++;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    seconds = (double)(end.tv_sec - start.tv_sec) + ((double)(end.tv_nsec - start.tv_nsec) / 1e9);
+    cycle_combatants = (n_double)placed * (n_double)(cycles ? cycles : 1);
+
+    printf("%lu,%lu,%lu,%ld,%.3f,%.1f,%lu", scenario->combatants, placed, scenario->units, cycles,
+           seconds, (seconds > 0.0) ? ((n_double)cycles / seconds) : 0.0, battle->memory_used);
+    while (loop < (sizeof(phases) / sizeof(phases[0]))) {
+        printf(",%.2f", (n_double)battle->profile->total[phases[loop]] / cycle_combatants);
+        loop++;
+    }
+    printf("\n");
+    fflush(stdout);
+
+    (void)engine_profile(battle, 0, 0);
+    scenario->units = asked_units;
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    static n_battle battle;
+    bench_scenario scenario;
+    n_uint sizes[BENCH_SIZES] = {1000, 10000, 100000, 1000000};
+    n_int size_count = 4;
+    n_int ticks = 100;
+    n_uint seed = 1;
+    n_int argument = 1;
+    n_int loop = 0;
+    n_int result = 0;
+
+    memory_erase((n_byte *)&scenario, sizeof(scenario));
+    scenario.density = 0.25;
+    scenario.threads = 1;
+    while (loop < BENCH_TYPES) {
+        scenario.mix[loop++] = 1;
+    }
+
+    while (argument < argc) {
+        if ((argv[argument][0] != '-') || ((argument + 1) == argc)) {
+            break;
+        }
+        if (strcmp(argv[argument], "-c") == 0) {
+            size_count = bench_list(argv[argument + 1], sizes, BENCH_SIZES);
+        } else if (strcmp(argv[argument], "-u") == 0) {
+            scenario.units = strtoul(argv[argument + 1], NOTHING, 10);
+        } else if (strcmp(argv[argument], "-d") == 0) {
+            scenario.density = strtod(argv[argument + 1], NOTHING);
+        } else if (strcmp(argv[argument], "-m") == 0) {
+            if (bench_list(argv[argument + 1], scenario.mix, BENCH_TYPES) != BENCH_TYPES) {
+                size_count = -1;
+            }
+        } else if (strcmp(argv[argument], "-t") == 0) {
+            ticks = strtol(argv[argument + 1], NOTHING, 10);
+        } else if (strcmp(argv[argument], "-s") == 0) {
+            seed = strtoul(argv[argument + 1], NOTHING, 10);
+        } else if (strcmp(argv[argument], "-j") == 0) {
+            scenario.threads = strtoul(argv[argument + 1], NOTHING, 10);
+        } else if (strcmp(argv[argument], "-M") == 0) {
+            scenario.move_method = strtoul(argv[argument + 1], NOTHING, 10);
+        } else if (strcmp(argv[argument], "-S") == 0) {
+            scenario.sort_interval = strtoul(argv[argument + 1], NOTHING, 10);
+        } else {
+            break;
+        }
+        argument += 2;
+    }
+
+    if ((argument != argc) || (size_count < 1) || (ticks < 1) || (scenario.density <= 0.0) ||
+        ((scenario.mix[0] + scenario.mix[1] + scenario.mix[2] + scenario.mix[3]) == 0) ||
+        (scenario.threads < 1) || (scenario.threads > EXECUTE_THREADS_MAX) || (scenario.move_method > MOVE_CONCURRENT) ||
+        (scenario.sort_interval > 0xFFFF)) {
+        fprintf(stderr, "usage: %s [-c combatants] [-u units] [-d density] [-m mix] [-t ticks] [-s seed] [-j threads] [-M move] [-S sort]\n", argv[0]);
+        return 1;
+    }
+
+    battle.quiet = 1;
+    (void)engine_init(&battle, 0);
+
+    printf("combatants,placed,units,cycles,seconds,cycles_per_second,memory_used,"
+           "opponent_ns,sort_ns,move_ns,grid_ns,declare_ns,attack_ns,remove_dead_ns,formation_ns,cycle_ns\n");
+    loop = 0;
+    while ((loop < size_count) && (result == 0)) {
+        scenario.combatants = sizes[loop++];
+        result = bench_run(&battle, &scenario, ticks, seed);
+    }
+
+    engine_exit(&battle);
+    execute_close();
+    return (result < 0) ? 1 : 0;
+}
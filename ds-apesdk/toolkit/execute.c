@@ -0,0 +1,220 @@
+/****************************************************************
+
+ execute.c
+
+ =============================================================
+
+ Copyright 1996-2025 Tom Barbalet. All rights reserved.
+
+ Permission is hereby granted, free of charge, to any person
+ obtaining a copy of this software and associated documentation
+ files (the "Software"), to deal in the Software without
+ restriction, including without limitation the rights to use,
+ copy, modify, merge, publish, distribute, sublicense, and/or
+ sell copies of the Software, and to permit persons to whom the
+ Software is furnished to do so, subject to the following
+ conditions:
+
+ The above copyright notice and this permission notice shall be
+ included in all copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ OTHER DEALINGS IN THE SOFTWARE.
+
+ This software is a continuing work of Tom Barbalet, begun on
+ 13 June 1996. No apes or cats were harmed in the writing of
+ this software.
+
+ ****************************************************************/
+
+/*! \file   execute.c
+ *  \brief  Runs groups of independent items across a pool of worker threads.
+ */
+
+#include "toolkit.h"
+
+#ifndef _WIN32
+#include <pthread.h>
+#endif
+
+// Threads used by execute_group, including the calling thread
+static n_int execute_thread_count = 1;
+
+// Run a single item of a group
+static void execute_item(execute_function *function, void *general_data, n_byte *read_data, n_int item, n_int size) {
+    (void)function(general_data, &read_data[item * size], NOTHING);
+}
+
+#ifndef _WIN32
+
+// The group currently handed to the workers, one pool for the whole process
+static execute_function *pool_function = NOTHING;
+static void *pool_general_data = NOTHING;
+static n_byte *pool_read_data = NOTHING;
+static n_int pool_count = 0;
+static n_int pool_size = 0;
+static n_int pool_next = 0;
+
+// Workers yet to finish the current group
+static n_int pool_busy = 0;
+static n_uint pool_generation = 0;
+static n_byte pool_quit = 0;
+
+static pthread_t pool_threads[EXECUTE_THREADS_MAX];
+static n_uint pool_seen[EXECUTE_THREADS_MAX];
+static n_int pool_running = 0;
+
+static pthread_mutex_t pool_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t pool_start = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t pool_done = PTHREAD_COND_INITIALIZER;
+
+// Take items from the current group until none remain, called with the mutex held
+static void execute_pool_items(void) {
+    while (pool_next < pool_count) {
+        n_int item = pool_next++;
+        pthread_mutex_unlock(&pool_mutex);
+        execute_item(pool_function, pool_general_data, pool_read_data, item, pool_size);
+        pthread_mutex_lock(&pool_mutex);
+    }
+}
+
+// Worker thread, waits for each new group and helps to run it
+static void *execute_worker(void *seen_generation) {
+    n_uint *seen = (n_uint *)seen_generation;
+    pthread_mutex_lock(&pool_mutex);
+    while (1) {
+        while ((pool_generation == *seen) && (pool_quit == 0)) {
+            pthread_cond_wait(&pool_start, &pool_mutex);
+        }
+        if (pool_quit) {
+            break;
+        }
+        *seen = pool_generation;
+        execute_pool_items();
+        pool_busy--;
+        if (pool_busy == 0) {
+            pthread_cond_signal(&pool_done);
+        }
+    }
+    pthread_mutex_unlock(&pool_mutex);
+    return NOTHING;
+}
+
+// Start the workers needed for the current thread count, each from the current group
+static void execute_pool_start(void) {
+    while (pool_running < (execute_thread_count - 1)) {
+        pool_seen[pool_running] = pool_generation;
+        if (pthread_create(&pool_threads[pool_running], NOTHING, &execute_worker, &pool_seen[pool_running]) != 0) {
+            (void)SHOW_ERROR("Worker thread not started");
+            execute_thread_count = pool_running + 1;
+            return;
+        }
+        pool_running++;
+    }
+}
+
+// Stop and join all the workers
+static void execute_pool_stop(void) {
+    n_int loop = 0;
+    pthread_mutex_lock(&pool_mutex);
+    pool_quit = 1;
+    pthread_cond_broadcast(&pool_start);
+    pthread_mutex_unlock(&pool_mutex);
+    while (loop < pool_running) {
+        pthread_join(pool_threads[loop], NOTHING);
+        loop++;
+    }
+    pool_running = 0;
+    pool_quit = 0;
+}
+
+#endif
+
+/**
+ * Sets the number of threads execute_group spreads its items over.
+ * One runs every item on the calling thread.
+ */
+void execute_threads(n_int value) {
+    if (value < 1) {
+        value = 1;
+    }
+    if (value > EXECUTE_THREADS_MAX) {
+        value = EXECUTE_THREADS_MAX;
+    }
+#ifdef _WIN32
+    value = 1;
+#else
+    if (pool_running > (value - 1)) {
+        execute_pool_stop();
+    }
+#endif
+    execute_thread_count = value;
+}
+
+/**
+ * Returns the number of threads execute_group uses.
+ */
+n_int execute_threads_value(void) {
+    return execute_thread_count;
+}
+
+/**
+ * Stops the worker threads.
+ */
+void execute_close(void) {
+#ifndef _WIN32
+    if (pool_running) {
+        execute_pool_stop();
+    }
+#endif
+}
+
+/**
+ * Runs function over count items of size bytes from read_data. The items
+ * are handed out in turn to the worker threads and the calling thread,
+ * which returns once every item is complete. Items must be independent
+ * of each other as the order they run in is not fixed. The pool is shared
+ * by the process, so only one thread may call execute_group at a time and
+ * an item must not call it again.
+ */
+void execute_group(execute_function *function, void *general_data, void *read_data, n_int count, n_int size) {
+    n_int loop = 0;
+
+#ifndef _WIN32
+    if ((execute_thread_count > 1) && (count > 1)) {
+        execute_pool_start();
+    }
+
+    if ((pool_running > 0) && (count > 1)) {
+        pthread_mutex_lock(&pool_mutex);
+        pool_function = function;
+        pool_general_data = general_data;
+        pool_read_data = (n_byte *)read_data;
+        pool_count = count;
+        pool_size = size;
+        pool_next = 0;
+        pool_busy = pool_running;
+        pool_generation++;
+        pthread_cond_broadcast(&pool_start);
+
+        execute_pool_items();
+
+        while (pool_busy > 0) {
+            pthread_cond_wait(&pool_done, &pool_mutex);
+        }
+        pthread_mutex_unlock(&pool_mutex);
+        return;
+    }
+#endif
+
+    while (loop < count) {
+        execute_item(function, general_data, (n_byte *)read_data, loop, size);
+        loop++;
+    }
+}
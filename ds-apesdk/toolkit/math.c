@@ -40,6 +40,11 @@
  */
 
 #include "toolkit.h"
+#include <stdlib.h>
+
+#ifndef _WIN32
+#include <pthread.h>
+#endif
 
 /**
  This is used to produce a series of steps between two points useful for drawing
@@ -215,7 +220,14 @@ n_uint math_hash( n_byte *values, n_uint length )
     return ( n_uint )( round[0] | ( round[1] << 16 ) );
 }
 
-n_int math_tan( n_vect2 *p )
+/**
+ Finds the direction, of the 256 directions, closest to a vector by a
+ binary search over the directions. math_tan gives the same result through
+ a table, this remains as the reference for that table.
+ @param p The vector.
+ @return The direction from 0 to 255.
+ */
+n_int math_tan_search( n_vect2 *p )
 {
     n_int   return_value = 0, best_p;
     n_vect2 vector_facing;
@@ -247,6 +259,261 @@ n_int math_tan( n_vect2 *p )
     return (return_value + 256) & 255;
 }
 
+/*
+ The search only compares the dot products of the vector with two directions
+ a power of two apart, so its result depends on the angle of the vector and
+ can only change on the rays perpendicular to the difference of those two
+ directions. Each octant holds these rays sorted by slope, with the search
+ result on each ray and between it and the next. A slope bucket table finds
+ the ray at or before a slope, leaving a scan of at most a few rays.
+ */
+
+#define MATH_TAN_RAYS       ((256 * 8 * 2) + 16)
+#define MATH_TAN_BUCKETS    (1024)
+
+typedef struct
+{
+    n_byte2 w;      /* the smaller of the absolute x and y */
+    n_byte2 u;      /* the larger */
+    n_byte  octant;
+    n_byte  on_ray;
+    n_byte  between;
+} n_tan_ray;
+
+static n_tan_ray math_tan_rays[MATH_TAN_RAYS];
+static n_byte2   math_tan_octant[9];
+static n_byte2   math_tan_bucket[8][MATH_TAN_BUCKETS + 1];
+static n_byte    math_tan_ready = 0;
+
+static n_byte math_tan_octant_of( n_int x, n_int y, n_int *w, n_int *u )
+{
+    n_int ax = ( x < 0 ) ? -x : x;
+    n_int ay = ( y < 0 ) ? -y : y;
+    n_byte swap = ( ay > ax );
+    *w = swap ? ax : ay;
+    *u = swap ? ay : ax;
+    return ( n_byte )( ( x < 0 ) | ( ( y < 0 ) << 1 ) | ( swap << 2 ) );
+}
+
+static void math_tan_vector( n_byte octant, n_int w, n_int u, n_vect2 *vect )
+{
+    n_int ax = ( octant & 4 ) ? w : u;
+    n_int ay = ( octant & 4 ) ? u : w;
+    vect->x = ( octant & 1 ) ? -ax : ax;
+    vect->y = ( octant & 2 ) ? -ay : ay;
+}
+
+static int math_tan_compare( const void *a, const void *b )
+{
+    const n_tan_ray *ray_a = ( const n_tan_ray * )a;
+    const n_tan_ray *ray_b = ( const n_tan_ray * )b;
+    n_int difference;
+
+    if ( ray_a->octant != ray_b->octant )
+    {
+        return ( int )ray_a->octant - ( int )ray_b->octant;
+    }
+    difference = ( ( n_int )ray_a->w * ray_b->u ) - ( ( n_int )ray_b->w * ray_a->u );
+    return ( difference > 0 ) - ( difference < 0 );
+}
+
+static void math_tan_add( n_tan_ray *rays, n_uint *count, n_int x, n_int y )
+{
+    n_int w, u;
+    n_byte octant = math_tan_octant_of( x, y, &w, &u );
+    n_int a = w, b = u;
+
+    while ( b != 0 )
+    {
+        n_int t = a % b;
+        a = b;
+        b = t;
+    }
+    rays[*count].w = ( n_byte2 )( w / a );
+    rays[*count].u = ( n_byte2 )( u / a );
+    rays[*count].octant = octant;
+    ( *count )++;
+}
+
+/* run once, before any thread reads the table, through math_tan_prepare */
+static n_int math_tan_init( void )
+{
+    n_tan_ray *rays = ( n_tan_ray * )memory_new( sizeof( n_tan_ray ) * MATH_TAN_RAYS );
+    n_uint count = 0, unique = 0, loop = 0;
+    n_int  direction = 0;
+
+    if ( rays == 0L )
+    {
+        return -1;
+    }
+
+    while ( direction < 256 )
+    {
+        n_int step = 1;
+        while ( step < 256 )
+        {
+            n_vect2 first, second;
+            vect2_direction( &first, direction, 8 );
+            vect2_direction( &second, direction + step, 8 );
+            second.x -= first.x;
+            second.y -= first.y;
+            if ( ( second.x != 0 ) || ( second.y != 0 ) )
+            {
+                math_tan_add( rays, &count, -second.y, second.x );
+                math_tan_add( rays, &count, second.y, -second.x );
+            }
+            step = step << 1;
+        }
+        direction++;
+    }
+
+    /* every octant is bounded by its axis and its diagonal */
+    while ( loop < 8 )
+    {
+        rays[count].w = 0;
+        rays[count].u = 1;
+        rays[count++].octant = ( n_byte )loop;
+        rays[count].w = 1;
+        rays[count].u = 1;
+        rays[count++].octant = ( n_byte )loop;
+        loop++;
+    }
+
+    qsort( rays, count, sizeof( n_tan_ray ), &math_tan_compare );
+
+    loop = 0;
+    while ( loop < count )
+    {
+        if ( ( unique == 0 ) || math_tan_compare( &rays[unique - 1], &rays[loop] ) )
+        {
+            rays[unique++] = rays[loop];
+        }
+        loop++;
+    }
+
+    loop = 0;
+    while ( loop < unique )
+    {
+        n_tan_ray *ray = &rays[loop];
+        n_vect2    vect;
+
+        math_tan_vector( ray->octant, ray->w, ray->u, &vect );
+        ray->on_ray = ( n_byte )math_tan_search( &vect );
+
+        if ( ( loop + 1 < unique ) && ( rays[loop + 1].octant == ray->octant ) )
+        {
+            math_tan_vector( ray->octant, ray->w + rays[loop + 1].w, ray->u + rays[loop + 1].u, &vect );
+            ray->between = ( n_byte )math_tan_search( &vect );
+        }
+        else
+        {
+            ray->between = ray->on_ray;
+        }
+        loop++;
+    }
+
+    memory_copy( ( n_byte * )rays, ( n_byte * )math_tan_rays, sizeof( n_tan_ray ) * unique );
+    memory_free( ( void ** )&rays );
+
+    /* the rays are sorted by octant first and each octant has its bounds */
+    loop = 0;
+    while ( loop < unique )
+    {
+        if ( ( loop == 0 ) || ( math_tan_rays[loop - 1].octant != math_tan_rays[loop].octant ) )
+        {
+            math_tan_octant[math_tan_rays[loop].octant] = ( n_byte2 )loop;
+        }
+        loop++;
+    }
+    math_tan_octant[8] = ( n_byte2 )unique;
+
+    loop = 0;
+    while ( loop < 8 )
+    {
+        n_uint bucket = 0;
+        n_uint ray = math_tan_octant[loop];
+
+        while ( bucket <= MATH_TAN_BUCKETS )
+        {
+            while ( ( ray + 1 < math_tan_octant[loop + 1] ) &&
+                    ( ( ( n_uint )math_tan_rays[ray + 1].w * MATH_TAN_BUCKETS ) <= ( bucket * math_tan_rays[ray + 1].u ) ) )
+            {
+                ray++;
+            }
+            math_tan_bucket[loop][bucket] = ( n_byte2 )ray;
+            bucket++;
+        }
+        loop++;
+    }
+
+    math_tan_ready = 1;
+    return 0;
+}
+
+#ifndef _WIN32
+static pthread_once_t math_tan_once = PTHREAD_ONCE_INIT;
+#endif
+
+static void math_tan_once_init( void )
+{
+    ( void )math_tan_init();
+}
+
+/* the first caller builds the table and any other thread waits for it,
+   so the table is complete and visible before math_tan_ready is read */
+static void math_tan_prepare( void )
+{
+#ifdef _WIN32
+    if ( math_tan_ready == 0 )
+    {
+        math_tan_once_init();
+    }
+#else
+    ( void )pthread_once( &math_tan_once, &math_tan_once_init );
+#endif
+}
+
+/**
+ Finds the direction, of the 256 directions, closest to a vector. This
+ gives the same result as math_tan_search through an octant and slope table.
+ @param p The vector.
+ @return The direction from 0 to 255.
+ */
+n_int math_tan( n_vect2 *p )
+{
+    n_int      w, u;
+    n_byte     octant;
+    n_byte2    ray, end;
+    n_tan_ray *rays = math_tan_rays;
+
+    if ( ( p->x == 0 ) && ( p->y == 0 ) )
+    {
+        return 0;
+    }
+
+    math_tan_prepare();
+
+    if ( math_tan_ready == 0 )
+    {
+        return math_tan_search( p );
+    }
+
+    octant = math_tan_octant_of( p->x, p->y, &w, &u );
+    ray = math_tan_bucket[octant][( w * MATH_TAN_BUCKETS ) / u];
+    end = math_tan_octant[octant + 1];
+
+    while ( ( ray + 1 < end ) && ( ( w * rays[ray + 1].u ) >= ( rays[ray + 1].w * u ) ) )
+    {
+        ray++;
+    }
+
+    if ( ( w * rays[ray].u ) == ( rays[ray].w * u ) )
+    {
+        return rays[ray].on_ray;
+    }
+    return rays[ray].between;
+}
+
 n_int math_spline(n_vect2 * start_vector, n_vect2 * end_vector, n_vect2 * elements, n_int number_elements)
 {
     if (number_elements == 0)
@@ -428,6 +695,71 @@ void math_random3( n_byte2 *local )
 
 #endif
 
+#define MATH_RANDOM_GOLDEN (0x9e3779b9)
+
+/**
+ Mixes the bits of a four-byte value so each input bit affects every output bit.
+ @param value The value to be mixed.
+ @return The mixed value.
+ */
+static n_byte4 math_random_mix( n_byte4 value )
+{
+    value ^= value >> 16;
+    value *= 0x7feb352d;
+    value ^= value >> 15;
+    value *= 0x846ca68b;
+    value ^= value >> 16;
+    return value;
+}
+
+/**
+ Splits a key for the counter based random numbers. Keys split from the same
+ key with different values give independent random numbers, so a key can be
+ split in turn by the seed, the cycle, the unit and the purpose of the roll.
+ @param key The key to be split.
+ @param value The value identifying the new key.
+ @return The new key.
+ */
+n_byte4 math_random_key( n_byte4 key, n_byte4 value )
+{
+    return math_random_mix( key ^ math_random_mix( value + MATH_RANDOM_GOLDEN ) );
+}
+
+/**
+ Produces the counter based random number for a key and a counter. Unlike
+ math_random there is no state to advance, the same key and counter always give
+ the same number so the numbers can be drawn in any order.
+ @param key The key from math_random_key.
+ @param counter The counter, for example the combatant number.
+ @return The four-byte random number.
+ */
+n_byte4 math_random_counter( n_byte4 key, n_byte4 counter )
+{
+    return math_random_mix( math_random_mix( key + ( counter * MATH_RANDOM_GOLDEN ) ) ^ key );
+}
+
+/**
+ Fills values with the counter based random numbers for count counters
+ from counter. Each value is independent of the others so the loop
+ vectorizes.
+ @param key The key from math_random_key.
+ @param counter The first counter.
+ @param values The values to be filled.
+ @param count The number of values to fill.
+ */
+void math_random_batch( n_byte4 key, n_byte4 counter, n_byte4 *values, n_uint count )
+{
+    n_uint loop = 0;
+
+    NA_ASSERT( values, "values NULL" );
+
+    while ( loop < count )
+    {
+        values[loop] = math_random_mix( math_random_mix( key + ( ( counter + ( n_byte4 )loop ) * MATH_RANDOM_GOLDEN ) ) ^ key );
+        loop++;
+    }
+}
+
 /* math_newton_root may need to be obsoleted */
 n_uint math_root( n_uint input )
 {
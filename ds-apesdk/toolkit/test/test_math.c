@@ -39,6 +39,7 @@
 #include "../toolkit.h"
 
 #include <stdio.h>
+#include <time.h>
 
 n_int draw_error( n_constant_string error_text, n_constant_string location, n_int line_number )
 {
@@ -154,6 +155,132 @@ n_int check_tan(n_byte initial_direction)
     return math_tan( &initial_facing );
 }
 
+#define CHECK_RANDOM_COUNT (1 << 20)
+
+void check_random_counter( void )
+{
+    n_byte4 key = math_random_key( 0x12345678, 7 );
+    n_byte4 values[256];
+    n_uint  buckets[16] = {0};
+    n_uint  loop = 0;
+
+    if ( key == math_random_key( 0x12345678, 8 ) )
+    {
+        printf( "split keys expected to differ\n" );
+    }
+
+    math_random_batch( key, 1000, values, 256 );
+
+    /* drawn backwards, the numbers are the same as the batch */
+    loop = 256;
+    while ( loop > 0 )
+    {
+        loop--;
+        if ( values[loop] != math_random_counter( key, 1000 + ( n_byte4 )loop ) )
+        {
+            printf( "batch value %ld differs from counter value\n", loop );
+        }
+    }
+
+    if ( math_random_counter( key, 5 ) != math_random_counter( key, 5 ) )
+    {
+        printf( "counter value not reproduced\n" );
+    }
+
+    if ( math_random_counter( key, 5 ) == math_random_counter( math_random_key( 0x12345678, 8 ), 5 ) )
+    {
+        printf( "counter values from split keys expected to differ\n" );
+    }
+
+    loop = 0;
+    while ( loop < CHECK_RANDOM_COUNT )
+    {
+        buckets[( math_random_counter( key, ( n_byte4 )loop ) >> 7 ) & 15]++;
+        loop++;
+    }
+
+    loop = 0;
+    while ( loop < 16 )
+    {
+        n_int difference = ( n_int )buckets[loop] - ( CHECK_RANDOM_COUNT / 16 );
+        if ( ( difference * 100 ) > ( CHECK_RANDOM_COUNT / 16 ) || ( difference * 100 ) < -( CHECK_RANDOM_COUNT / 16 ) )
+        {
+            printf( "counter bucket %ld uneven with %ld\n", loop, buckets[loop] );
+        }
+        loop++;
+    }
+}
+
+/* every vector between two points on a 1024 by 768 board */
+
+#define CHECK_TAN_WIDTH  (1024)
+#define CHECK_TAN_HEIGHT (768)
+
+void check_tan_table( void )
+{
+    n_int px = 1 - CHECK_TAN_WIDTH;
+    n_int failures = 0;
+
+    while ( px < CHECK_TAN_WIDTH )
+    {
+        n_int py = 1 - CHECK_TAN_HEIGHT;
+        while ( py < CHECK_TAN_HEIGHT )
+        {
+            n_vect2 value = {px, py};
+            n_int table = math_tan( &value );
+            n_int search = math_tan_search( &value );
+            if ( table != search )
+            {
+                if ( failures < 10 )
+                {
+                    printf( "math_tan(%ld, %ld) %ld expects %ld\n", px, py, table, search );
+                }
+                failures++;
+            }
+            py++;
+        }
+        px++;
+    }
+    if ( failures )
+    {
+        printf( "math_tan differs from math_tan_search %ld times\n", failures );
+    }
+}
+
+/* times both over the same vectors, the sum keeps the calls */
+
+n_int check_tan_timing( n_int ( *tan_function )( n_vect2 *p ), n_int *sum )
+{
+    clock_t start = clock();
+    n_int   px = 1 - CHECK_TAN_WIDTH;
+
+    while ( px < CHECK_TAN_WIDTH )
+    {
+        n_int py = 1 - CHECK_TAN_HEIGHT;
+        while ( py < CHECK_TAN_HEIGHT )
+        {
+            n_vect2 value = {px, py};
+            *sum += tan_function( &value );
+            py += 3;
+        }
+        px += 3;
+    }
+    return ( n_int )( ( ( clock() - start ) * 1000 ) / CLOCKS_PER_SEC );
+}
+
+void check_tan_benchmark( void )
+{
+    n_int sum_table = 0, sum_search = 0;
+    n_int table_ms = check_tan_timing( &math_tan, &sum_table );
+    n_int search_ms = check_tan_timing( &math_tan_search, &sum_search );
+
+    if ( sum_table != sum_search )
+    {
+        printf( "math_tan benchmark sums differ\n" );
+    }
+    printf( "math_tan %ld ms, math_tan_search %ld ms\n", table_ms, search_ms );
+}
+
 void check_math( void )
 {
     n_int   loop = 0;
@@ -166,6 +293,9 @@ void check_math( void )
     ( void )check_root( 3, 15 );
     ( void )check_root( 3, 14 );
     check_intersection();
+    check_random_counter();
+    check_tan_table();
+    check_tan_benchmark();
 
     while ( loop < 256 )
     {
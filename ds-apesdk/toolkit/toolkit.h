@@ -59,7 +59,13 @@
 #define IS_RETURN(val)            (((val) == 10) || ((val) == 13))
 #define IS_SPACE(val)             ((val) == CHAR_SPACE)
 
-#undef  SIMULATED_APE_ASSERT
+// #define SIMULATED_APE_ASSERT_ON /* should be passed via target definitions via cmd */
+
+#ifdef SIMULATED_APE_ASSERT_ON
+    #define SIMULATED_APE_ASSERT
+#else
+    #undef  SIMULATED_APE_ASSERT
+#endif
 
 #define PACKED_DATA_BLOCK   (32*32*32*2)
 
@@ -95,6 +101,10 @@ typedef	unsigned char	n_byte;
 typedef	unsigned short	n_byte2;
 
 typedef	unsigned int	n_byte4;
+/*! @typedef n_byte8
+@discussion This is an eight byte data unit, for values that need
+ 64 bits where n_uint may only be four bytes. */
+typedef	unsigned long long	n_byte8;
 typedef	int				n_c_int;
 
 #ifndef _WIN64
@@ -493,7 +503,12 @@ extern n_int draw_error( n_constant_string error_text, n_constant_string locatio
 typedef n_int ( execute_function )( void *general_data, void *read_data, void *write_data );
 typedef void ( execute_thread_stub )( execute_function function, void *general_data, void *read_data, void *write_data );
 
+#define EXECUTE_THREADS_MAX     (64)
+
 void  execute_group( execute_function *function, void *general_data, void *read_data, n_int count, n_int size );
+void  execute_threads( n_int value );
+n_int execute_threads_value( void );
+void  execute_close( void );
 
 void area2_add( n_area2 *area, n_vect2 *vect, n_byte first );
 
@@ -568,8 +583,13 @@ void math_general_execution( n_int instruction, n_int is_constant0, n_int is_con
 n_byte4  math_hash_fnv1( n_constant_string key );
 n_uint   math_hash( n_byte *values, n_uint length );
 
+n_byte4  math_random_key( n_byte4 key, n_byte4 value );
+n_byte4  math_random_counter( n_byte4 key, n_byte4 counter );
+void     math_random_batch( n_byte4 key, n_byte4 counter, n_byte4 *values, n_uint count );
+
 n_uint  math_root( n_uint squ );
 n_int   math_tan( n_vect2 *p );
+n_int   math_tan_search( n_vect2 *p );
 
 #undef DEBUG_RANDOM
 #undef VERBOSE_DEBUG_RANDOM
@@ -35,89 +35,403 @@
 
 
 #include <stdio.h>
+#include <stdlib.h>
 #include "toolkit.h"
 #include "battle.h"
 
-// Global variables
-n_unit   *units;
-n_byte2   number_units;
-n_type   *types;
-n_byte2   number_types;
-
 // Function prototypes
+void * battle_combatants(n_battle *battle, n_index number);
+void combatant_get(n_unit *un, n_index num, n_combatant *comb);
+void combatant_set(n_unit *un, n_index num, n_combatant *comb);
 void combatant_loop(combatant_function func, n_unit *un, n_general_variables *gvar, void *values);
+void combatant_loop_living(combatant_function func, n_unit *un, n_general_variables *gvar, void *values);
+void battle_living(n_unit *un);
 static void battle_area(n_unit *unit);
-void battle_loop(battle_function func, n_unit *un, const n_uint count, n_general_variables *gvar);
-n_byte battle_alignment_color(n_unit *un);
+static void battle_area_insert(n_unit *unit, n_vect2 *location);
+static void battle_area_remove(n_unit *unit, n_vect2 *location);
+void battle_loop(battle_function func, n_battle *battle, n_unit *un, const n_uint count);
+static void battle_random_stream(n_general_variables *gvar, n_uint index, n_general_variables *local);
+static n_int battle_job_run(void *general_data, void *read_data, void *write_data);
+void battle_loop_execute(battle_function func, n_battle *battle, n_unit *un, const n_uint count);
 void combatant_fill(n_combatant *comb, n_general_variables *gvar, void *values);
-void battle_fill(n_unit *un, n_general_variables *gvar);
+static n_index battle_template_slots(n_battle *battle, n_byte stature, n_byte angle, n_index width);
+static n_template *battle_template(n_battle *battle, n_unit *un, n_index width);
+static void battle_template_edge(n_template *tmp, n_unit *un, n_int *edge);
+n_byte battle_formation_slot(n_unit *un, n_index num, n_vect2 *slot);
+void battle_fill(n_battle *battle, n_unit *un);
 static n_int battle_calc_damage(n_int wounds, n_int damage);
-static void battle_combatant_attack(n_combatant *comb, n_combatant *comb_at, n_general_variables *gvar, void *additional_variables);
-void battle_attack(n_unit *un, n_general_variables *gvar);
-static n_int combatant_random_facing(n_int local_facing, n_general_variables *gvar);
-static void battle_combatant_declare(n_combatant *comb, n_general_variables *gvar, n_unit *un_at, n_byte reverso, n_byte group_facing);
-void battle_declare(n_unit *un, n_general_variables *gvar);
-void combatant_dead(n_combatant *comb);
-static void combatant_move(n_combatant *comb, n_general_variables *gvar, void *values);
-void battle_move(n_unit *un, n_general_variables *gvar);
-void battle_remove_dead(n_unit *un, n_general_variables *gvar);
-n_byte battle_opponent(n_unit *un, n_uint num, n_uint *no_movement);
+static void battle_wound(n_byte *wounds, n_int damage, n_byte parallel);
+static n_byte4 battle_random_key(n_battle *battle, n_unit *un, n_byte4 purpose);
+static void battle_combatant_attack(n_unit *un, n_index num, void *comb_at, n_general_variables *gvar, void *additional_variables, n_int dice_roll);
+void battle_attack(n_battle *battle, n_unit *un);
+static n_int combatant_random_facing(n_int local_facing, n_general_variables *gvar, n_byte4 random_key, n_index num);
+void battle_grid(n_battle *battle, n_unit *un);
+static n_index battle_grid_search(n_vect2 *loc, n_vect2 *facing, n_unit *un_at, n_byte reverso, n_general_variables *gvar, n_distance *distance_squ);
+static void battle_combatant_declare(void *comb, n_index num, n_general_variables *gvar, n_unit *un_at, n_byte reverso, n_byte group_facing, n_byte4 random_key);
+static n_int battle_span_gap(n_int low, n_int high, n_int other_low, n_int other_high);
+void battle_declare(n_battle *battle, n_unit *un);
+void combatant_dead(n_unit *un, n_index num);
+static void combatant_speed(n_unit *un, n_index num, n_byte speed);
+static n_byte combatant_destination(n_unit *un, n_index num, n_int cycles, n_vect2 *old_location, n_vect2 *new_location);
+static void combatant_move(n_battle *battle, n_unit *un, n_index num, n_int cycles);
+static n_int battle_missile_range(n_unit *un);
+static n_int battle_matchup_probability(n_int attack, n_int defence, n_int armour_piercing);
+n_int battle_matchups(n_battle *battle);
+void battle_move(n_battle *battle, n_unit *un);
+void battle_remove_dead(n_battle *battle, n_unit *un);
+static n_uint battle_morton_spread(n_uint value);
+static int battle_sort_compare(const void *a, const void *b);
+void battle_sort(n_battle *battle, n_unit *un);
+n_byte battle_opponent(n_battle *battle);
 
 // Struct definitions
 typedef struct {
-    n_vect2 px;
-    n_vect2 py;
-    n_vect2 dpx;
-    n_vect2 dpy;
+    n_vect2 *offsets;
     n_int   edgex;
     n_int   edgey;
-    n_byte  color;
+    n_byte  side;
     n_int   loc_angle;
     n_byte  loc_wounds;
-    n_int   line;
-    n_int   loc_width;
+    n_index slot;
+    n_byte4 *board;
 } battle_fill_struct;
 
+typedef struct {
+    battle_function     func;
+    n_unit             *un;
+    n_uint              count;
+    n_battle            battle;
+} battle_job;
+
 // Function implementations
 
+/**
+ * Allocates and erases the combatants of a unit from the engine memory.
+ */
+void * battle_combatants(n_battle *battle, n_index number) {
+#ifdef COMBATANT_SOA
+    n_uint rounded = (number + 7) & ~7;
+    n_uint block_size = rounded * ((sizeof(n_byte2) * 2) + sizeof(n_index) + sizeof(n_distance) + (sizeof(n_byte) * 4));
+    n_combatant_array *array = (n_combatant_array *)mem_use(battle, sizeof(n_combatant_array));
+    n_byte *block = mem_use(battle, block_size);
+
+    memory_erase(block, block_size);
+
+    array->x = (n_byte2 *)block;
+    array->y = &array->x[rounded];
+    array->attacking = (n_index *)&array->y[rounded];
+    array->distance_squ = (n_distance *)&array->attacking[rounded];
+    array->speed_current = (n_byte *)&array->distance_squ[rounded];
+    array->direction_facing = &array->speed_current[rounded];
+    array->wounds = &array->direction_facing[rounded];
+    array->combatant_state = &array->wounds[rounded];
+
+    return (void *)array;
+#elif defined(COMBATANT_COMPACT)
+    n_byte *block = mem_use(battle, sizeof(n_combatant_compact) * number);
+    memory_erase(block, sizeof(n_combatant_compact) * number);
+    return (void *)block;
+#else
+    n_byte *block = mem_use(battle, sizeof(n_combatant) * number);
+    memory_erase(block, sizeof(n_combatant) * number);
+    return (void *)block;
+#endif
+}
+
+/**
+ * Copies a combatant out of its unit's storage.
+ */
+void combatant_get(n_unit *un, n_index num, n_combatant *comb) {
+#ifndef COMBATANT_AOS
+    void *combatants = un->combatants;
+    COMBATANT_LOCATION(combatants, num, &comb->location);
+    comb->attacking = COMBATANT_ATTACKING(combatants, num);
+    comb->distance_squ = COMBATANT_DISTANCE(combatants, num);
+    comb->speed_current = COMBATANT_SPEED(combatants, num);
+    comb->direction_facing = COMBATANT_FACING(combatants, num);
+    comb->wounds = COMBATANT_WOUNDS(combatants, num);
+    comb->combatant_state = COMBATANT_STATE(combatants, num);
+#else
+    *comb = ((n_combatant *)(un->combatants))[num];
+#endif
+}
+
+/**
+ * Copies a combatant back into its unit's storage.
+ */
+void combatant_set(n_unit *un, n_index num, n_combatant *comb) {
+#ifndef COMBATANT_AOS
+    void *combatants = un->combatants;
+    COMBATANT_SET_LOCATION(combatants, num, &comb->location);
+    COMBATANT_ATTACKING(combatants, num) = comb->attacking;
+    COMBATANT_DISTANCE(combatants, num) = comb->distance_squ;
+    COMBATANT_SPEED(combatants, num) = comb->speed_current;
+    COMBATANT_FACING(combatants, num) = comb->direction_facing;
+    COMBATANT_WOUNDS(combatants, num) = comb->wounds;
+    COMBATANT_STATE(combatants, num) = comb->combatant_state;
+#else
+    ((n_combatant *)(un->combatants))[num] = *comb;
+#endif
+}
+
 /**
  * Iterates over all combatants in a unit and applies a function to each.
  */
 void combatant_loop(combatant_function func, n_unit *un, n_general_variables *gvar, void *values) {
+    n_index loop = 0;
+#ifndef COMBATANT_AOS
+    n_combatant combatant;
+    while (loop < un->number_combatants) {
+        combatant_get(un, loop, &combatant);
+        (*func)(&combatant, gvar, values); // <-- Pass values to func
+        combatant_set(un, loop++, &combatant);
+    }
+#else
     n_combatant *combatant = (n_combatant *)(un->combatants);
-    n_byte2 loop = 0;
     while (loop < un->number_combatants) {
         (*func)(&combatant[loop++], gvar, values); // <-- Pass values to func
     }
+#endif
+}
+
+/**
+ * Iterates over the living combatants in a unit and applies a function to each.
+ */
+void combatant_loop_living(combatant_function func, n_unit *un, n_general_variables *gvar, void *values) {
+    n_index loop = 0;
+#ifndef COMBATANT_AOS
+    n_combatant combatant;
+    while (loop < un->living_count) {
+        n_index num = un->living[loop++];
+        combatant_get(un, num, &combatant);
+        (*func)(&combatant, gvar, values);
+        combatant_set(un, num, &combatant);
+    }
+#else
+    n_combatant *combatant = (n_combatant *)(un->combatants);
+    while (loop < un->living_count) {
+        (*func)(&combatant[un->living[loop++]], gvar, values);
+    }
+#endif
 }
 
 /**
- * Calculates the battle area for a unit.
+ * Rebuilds the list of a unit's living combatants from their wounds, and the
+ * count of those moving.
+ */
+void battle_living(n_unit *un) {
+    void *comb = un->combatants;
+    n_index loop = 0;
+    n_index count = 0;
+    n_index moving = 0;
+    while (loop < un->number_combatants) {
+        if (COMBATANT_WOUNDS(comb, loop) != NUNIT_DEAD) {
+            un->living[count++] = loop;
+            moving += (COMBATANT_SPEED(comb, loop) != 0);
+        }
+        loop++;
+    }
+    un->living_count = count;
+    un->moving = moving;
+}
+
+/**
+ * Sets a living combatant's speed, keeping the unit's count of those moving.
+ */
+static void combatant_speed(n_unit *un, n_index num, n_byte speed) {
+    void *comb = un->combatants;
+    if ((COMBATANT_SPEED(comb, num) != 0) != (speed != 0)) {
+        if (speed != 0) {
+            un->moving++;
+        } else {
+            un->moving--;
+        }
+    }
+    COMBATANT_SPEED(comb, num) = speed;
+}
+
+/**
+ * Rebuilds the battle area for a unit from its living combatants, along with
+ * the column and row counts and the location sum that keep it up to date.
  */
 static void battle_area(n_unit *unit) {
-    n_combatant *combatant = (n_combatant *)unit->combatants;
+    void *comb = unit->combatants;
     n_int loop = 0;
-    while (loop < unit->number_combatants) {
-        area2_add(&(unit->area), &(combatant->location), loop == 0);
+    memory_erase((n_byte *)unit->columns, sizeof(n_byte2) * (BATTLE_BOARD_WIDTH + BATTLE_BOARD_HEIGHT));
+    vect2_populate(&unit->location_sum, 0, 0);
+    while (loop < unit->living_count) {
+        n_vect2 location;
+        COMBATANT_LOCATION(comb, unit->living[loop], &location);
+        area2_add(&(unit->area), &location, loop == 0);
+        unit->columns[location.x]++;
+        unit->rows[location.y]++;
+        vect2_d(&unit->location_sum, &location, 1, 1);
         loop++;
     }
 }
 
 /**
- * Iterates over all units and applies a function to each.
+ * Moves one edge of an area span inwards past empty columns or rows after
+ * the count at emptied drops to zero.
  */
-void battle_loop(battle_function func, n_unit *un, const n_uint count, n_general_variables *gvar) {
+static void battle_area_shrink(n_byte2 *counts, n_int *low, n_int *high, n_int emptied) {
+    if (emptied == *low) {
+        while ((*low < *high) && (counts[*low] == 0)) {
+            (*low)++;
+        }
+    } else if (emptied == *high) {
+        while ((*high > *low) && (counts[*high] == 0)) {
+            (*high)--;
+        }
+    }
+}
+
+/**
+ * Adds a living combatant's location to the unit's area and location sum.
+ */
+static void battle_area_insert(n_unit *unit, n_vect2 *location) {
+    unit->columns[location->x]++;
+    unit->rows[location->y]++;
+    vect2_d(&unit->location_sum, location, 1, 1);
+    area2_add(&(unit->area), location, 0);
+}
+
+/**
+ * Takes a location out of the unit's area and location sum. Insert any
+ * replacement location first so the area shrinks onto it.
+ */
+static void battle_area_remove(n_unit *unit, n_vect2 *location) {
+    unit->columns[location->x]--;
+    unit->rows[location->y]--;
+    vect2_d(&unit->location_sum, location, -1, 1);
+    if (unit->columns[location->x] == 0) {
+        battle_area_shrink(unit->columns, &unit->area.top_left.x, &unit->area.bottom_right.x, location->x);
+    }
+    if (unit->rows[location->y] == 0) {
+        battle_area_shrink(unit->rows, &unit->area.top_left.y, &unit->area.bottom_right.y, location->y);
+    }
+}
+
+#ifdef SIMULATED_APE_ASSERT
+
+/**
+ * Checks the incrementally kept area and location sum against a rebuild.
+ */
+static void battle_area_check(n_unit *unit) {
+    n_area2 area = unit->area;
+    n_vect2 location_sum = unit->location_sum;
+    if (unit->living_count == 0) {
+        return;
+    }
+    battle_area(unit);
+    NA_ASSERT(area.top_left.x == unit->area.top_left.x, "area left differs");
+    NA_ASSERT(area.top_left.y == unit->area.top_left.y, "area top differs");
+    NA_ASSERT(area.bottom_right.x == unit->area.bottom_right.x, "area right differs");
+    NA_ASSERT(area.bottom_right.y == unit->area.bottom_right.y, "area bottom differs");
+    NA_ASSERT(location_sum.x == unit->location_sum.x, "location sum x differs");
+    NA_ASSERT(location_sum.y == unit->location_sum.y, "location sum y differs");
+}
+
+#endif
+
+/**
+ * Iterates over all units and applies a function to each. When the profiler
+ * times units each unit's share of the phase is added to its total.
+ */
+void battle_loop(battle_function func, n_battle *battle, n_unit *un, const n_uint count) {
     n_uint loop = 0;
+    if (battle->profile && battle->profile->unit_total) {
+        while (loop < count) {
+            n_uint start = engine_profile_clock();
+            (*func)(battle, &un[loop]);
+            engine_profile_unit(battle, &un[loop++], start);
+        }
+        return;
+    }
     while (loop < count) {
-        (*func)(&un[loop++], gvar);
+        (*func)(battle, &un[loop++]);
     }
 }
 
 /**
- * Returns the color based on the unit's alignment.
+ * Seeds the random stream of a unit or chunk from the shared stream.
  */
-n_byte battle_alignment_color(n_unit *un) {
-    return (un->alignment == 0) ? 128 : 255;
+static void battle_random_stream(n_general_variables *gvar, n_uint index, n_general_variables *local) {
+    local->random0 = (n_byte2)(gvar->random0 ^ ((index + 1) * 0x9E37));
+    local->random1 = (n_byte2)(gvar->random1 + ((index + 1) * 0x79B9));
+    (void)math_random(&local->random0);
+    (void)math_random(&local->random0);
+}
+
+/**
+ * Runs a battle function over one chunk of units.
+ */
+static n_int battle_job_run(void *general_data, void *read_data, void *write_data) {
+    battle_job *job = (battle_job *)read_data;
+    battle_loop(job->func, &job->battle, job->un, job->count);
+    return 0;
+}
+
+/**
+ * Iterates over all units like battle_loop, splitting them across gvar->threads.
+ *
+ * With deterministic set each unit takes counter based rolls keyed by the
+ * cycle, the unit and the combatant, so the outcome is the same for any
+ * thread count. Otherwise more than one thread gives each thread's chunk of
+ * units a random stream, and one thread is battle_loop. Each chunk runs on
+ * its own copy of the battle, which holds its random stream. With one thread
+ * the chunks run here and the worker pool, shared by the process, is not used.
+ */
+void battle_loop_execute(battle_function func, n_battle *battle, n_unit *un, const n_uint count) {
+    n_general_variables *gvar = &battle->game_vars;
+    n_uint threads = (gvar->threads < 1) ? 1 : gvar->threads;
+    battle_job *jobs = (battle_job *)battle->jobs;
+    n_uint chunks;
+    n_uint loop = 0;
+
+    if ((gvar->deterministic == 0) && (threads == 1)) {
+        battle_loop(func, battle, un, count);
+        return;
+    }
+
+    chunks = gvar->deterministic ? count : ((threads < count) ? threads : count);
+
+    if (chunks > battle->jobs_size) {
+        if (jobs) {
+            memory_free((void **)&jobs);
+        }
+        jobs = (battle_job *)memory_new(sizeof(battle_job) * chunks);
+        battle->jobs = (void *)jobs;
+        if (jobs == NOTHING) {
+            battle->jobs_size = 0;
+            (void)SHOW_ERROR("Battle jobs not allocated");
+            return;
+        }
+        battle->jobs_size = chunks;
+    }
+
+    while (loop < chunks) {
+        n_uint start = (loop * count) / chunks;
+        jobs[loop].func = func;
+        jobs[loop].un = &un[start];
+        jobs[loop].count = (((loop + 1) * count) / chunks) - start;
+        jobs[loop].battle = *battle;
+        battle_random_stream(gvar, loop, &jobs[loop].battle.game_vars);
+        loop++;
+    }
+
+    if (threads == 1) {
+        loop = 0;
+        while (loop < chunks) {
+            (void)battle_job_run(NOTHING, &jobs[loop++], NOTHING);
+        }
+    } else {
+        execute_threads((n_int)threads);
+        execute_group(&battle_job_run, NOTHING, jobs, (n_int)chunks, sizeof(battle_job));
+    }
+
+    /* move the shared stream on for the next phase */
+    (void)math_random(&gvar->random0);
 }
 
 /**
@@ -125,51 +439,86 @@ n_byte battle_alignment_color(n_unit *un) {
  */
 void combatant_fill(n_combatant *comb, n_general_variables *gvar, void *values) {
     battle_fill_struct *local_bfs = (battle_fill_struct *)values;
+    n_vect2 *offset = &local_bfs->offsets[local_bfs->slot++];
 
-    n_int pos_x = ((((local_bfs->px.x + local_bfs->py.x) >> 9) + local_bfs->edgex) % BATTLE_BOARD_WIDTH);
-    n_int pos_y = ((((local_bfs->px.y - local_bfs->py.y) >> 9) + local_bfs->edgey) % BATTLE_BOARD_HEIGHT);
+    n_int pos_x = ((offset->x + local_bfs->edgex) % BATTLE_BOARD_WIDTH);
+    n_int pos_y = ((offset->y + local_bfs->edgey) % BATTLE_BOARD_HEIGHT);
 
     n_vect2 pos = {pos_x, pos_y};
 
-    if (board_add(&pos, local_bfs->color)) {
+    if (board_add(local_bfs->board, &pos, local_bfs->side)) {
         comb->location = pos;
         comb->direction_facing = (n_byte)local_bfs->loc_angle;
         comb->attacking = NUNIT_NO_ATTACK;
         comb->wounds = local_bfs->loc_wounds;
         comb->speed_current = 0;
     }
+}
 
-    local_bfs->line++;
-    if (local_bfs->line == local_bfs->loc_width) {
-        local_bfs->line = 0;
-        vect2_populate(&local_bfs->px, 0, 0);
-        vect2_d(&local_bfs->py, &local_bfs->dpy, 1, 1);
-    } else {
-        vect2_d(&local_bfs->px, &local_bfs->dpx, 1, 1);
+/**
+ * Finds the most combatants of any unit that can fill a template of the
+ * stature, angle and width, so a template is built once with enough slots.
+ */
+static n_index battle_template_slots(n_battle *battle, n_byte stature, n_byte angle, n_index width) {
+    n_index slots = 0;
+    n_uint loop = 0;
+
+    while (loop < battle->number_units) {
+        n_unit *test = &battle->units[loop++];
+        n_index test_width = (test->width > test->number_combatants) ? test->number_combatants : test->width;
+        if ((GET_TYPE(test)->stature == stature) && (test->angle == angle) && (test_width == width) &&
+            (test->number_combatants > slots)) {
+            slots = test->number_combatants;
+        }
     }
+    return slots;
 }
 
 /**
- * Fills the battle board with combatants from a unit.
+ * Finds the template of a unit's formation, stature, angle and width,
+ * building it when no unit has used it before. A unit's angle is fixed at
+ * load, so the exact angle keys the template.
  */
-// Update battle_fill to handle formations
-void battle_fill(n_unit *un, n_general_variables *gvar) {
-    battle_fill_struct local_bfs;
+static n_template *battle_template(n_battle *battle, n_unit *un, n_index width) {
+    n_type *typ = GET_TYPE(un);
+    n_template *tmp = NOTHING;
+    n_uint loop = 0;
     n_int dx = (UNIT_SIZE(un) + 2) / 2;
     n_int dy = (UNIT_SIZE(un) + 3) / 2;
-    n_int loc_angle = un->angle;
-    n_int loc_order = UNIT_ORDER(un);
-    n_int loc_height;
-    n_vect2 facing;
+    n_vect2 px = {0, 0}, py = {0, 0}, dpx, dpy;
+    n_index line = 0;
+    n_index slot = 0;
+
+    while (loop < battle->number_templates) {
+        n_template *test = &battle->templates[loop++];
+        if ((test->formation == un->formation) && (test->stature == typ->stature) &&
+            (test->angle == un->angle) && (test->width == width)) {
+            NA_ASSERT(test->slots >= un->number_combatants, "template slots too few");
+            return test;
+        }
+    }
 
-    local_bfs.loc_wounds = GET_TYPE(un)->wounds_per_combatant;
-    local_bfs.color = battle_alignment_color(un);
-    local_bfs.loc_width = un->width;
-    local_bfs.line = 0;
-    local_bfs.px = (n_vect2){0, 0};
-    local_bfs.py = (n_vect2){0, 0};
+    if (battle->number_templates == battle->templates_size) {
+        (void)SHOW_ERROR("Formation templates full");
+        return NOTHING;
+    }
+
+    tmp = &battle->templates[battle->number_templates];
+    tmp->slots = battle_template_slots(battle, typ->stature, un->angle, width);
+
+    if ((sizeof(n_vect2) * tmp->slots) > (battle->memory_allocated - battle->memory_used)) {
+        (void)SHOW_ERROR("Formation template not allocated");
+        return NOTHING;
+    }
+
+    battle->number_templates++;
+    tmp->formation = un->formation;
+    tmp->stature = typ->stature;
+    tmp->angle = un->angle;
+    tmp->width = width;
+    tmp->offsets = (n_vect2 *)mem_use(battle, sizeof(n_vect2) * tmp->slots);
 
-    vect2_direction(&facing, loc_angle, 16);
+    vect2_direction(&tmp->facing, un->angle, 16);
 
     // Adjust formation based on unit type
     switch (un->formation) {
@@ -203,15 +552,7 @@ void battle_fill(n_unit *un, n_general_variables *gvar) {
             break;
     }
 
-    if (local_bfs.loc_width > un->number_combatants) {
-        local_bfs.loc_width = un->number_combatants;
-    }
-
-    NA_ASSERT(local_bfs.loc_width, "width is zero");
-
-    loc_height = (un->number_combatants + local_bfs.loc_width - (un->number_combatants % local_bfs.loc_width)) / local_bfs.loc_width;
-
-    if ((loc_order & 1) == 1) {
+    if ((UNIT_ORDER(un) & 1) == 1) {
         if (dx == dy) {
             dx += 1;
             dy += 1;
@@ -219,17 +560,102 @@ void battle_fill(n_unit *un, n_general_variables *gvar) {
             dx = dy;
         }
     }
+    tmp->across = dx;
+    tmp->down = dy;
+
+    /* walk the slots line by line, the first line along the facing */
+    vect2_populate(&dpx, (tmp->facing.y * tmp->across), (tmp->facing.x * tmp->across));
+    vect2_populate(&dpy, (tmp->facing.x * tmp->down), (tmp->facing.y * tmp->down));
+
+    while (slot < tmp->slots) {
+        vect2_populate(&tmp->offsets[slot++], (px.x + py.x) >> 9, (px.y - py.y) >> 9);
+        line++;
+        if (line == width) {
+            line = 0;
+            vect2_populate(&px, 0, 0);
+            vect2_d(&py, &dpy, 1, 1);
+        } else {
+            vect2_d(&px, &dpx, 1, 1);
+        }
+    }
+    return tmp;
+}
+
+/**
+ * Finds the edge the slots of a unit's template are offset from, which
+ * centres the formation on the unit's average.
+ */
+static void battle_template_edge(n_template *tmp, n_unit *un, n_int *edge) {
+    n_int loc_height = (un->number_combatants + tmp->width - (un->number_combatants % tmp->width)) / tmp->width;
+    n_int dx = tmp->width * tmp->across;
+    n_int dy = loc_height * tmp->down;
+
+    edge[0] = un->average[0] - (((tmp->facing.y * dx) + (tmp->facing.x * dy)) >> 10);
+    edge[1] = un->average[1] - (((tmp->facing.x * dx) - (tmp->facing.y * dy)) >> 10);
+}
+
+/**
+ * Finds where a combatant's slot in its unit's formation is, about the
+ * unit's current average, for keeping formation. The slot follows the
+ * combatant when battle_sort reorders the unit. Returns zero when the
+ * unit has not been filled.
+ */
+n_byte battle_formation_slot(n_unit *un, n_index num, n_vect2 *slot) {
+    n_template *tmp = un->formation_template;
+    n_index index;
+    n_int edge[2];
+
+    if ((tmp == NOTHING) || (num >= un->number_combatants)) {
+        return 0;
+    }
+    index = un->slots[num];
+    battle_template_edge(tmp, un, edge);
+    vect2_populate(slot, (tmp->offsets[index].x + edge[0]) % BATTLE_BOARD_WIDTH, (tmp->offsets[index].y + edge[1]) % BATTLE_BOARD_HEIGHT);
+    return 1;
+}
+
+/**
+ * Fills the battle board with combatants from a unit, placing each in its
+ * slot of the unit's formation template.
+ */
+void battle_fill(n_battle *battle, n_unit *un) {
+    battle_fill_struct local_bfs;
+    n_index width = un->width;
+    n_template *tmp;
+    n_int edge[2];
+
+    if (width > un->number_combatants) {
+        width = un->number_combatants;
+    }
+
+    NA_ASSERT(width, "width is zero");
+
+    tmp = battle_template(battle, un, width);
+    if (tmp == NOTHING) {
+        return;
+    }
+    un->formation_template = tmp;
+    battle_template_edge(tmp, un, edge);
 
-    vect2_populate(&local_bfs.dpx, (facing.y * dx), (facing.x * dx));
-    vect2_populate(&local_bfs.dpy, (facing.x * dy), (facing.y * dy));
+    local_bfs.offsets = tmp->offsets;
+    local_bfs.edgex = edge[0];
+    local_bfs.edgey = edge[1];
+    local_bfs.loc_wounds = GET_TYPE(un)->wounds_per_combatant;
+    local_bfs.side = un->alignment;
+    local_bfs.loc_angle = un->angle;
+    local_bfs.slot = 0;
+    local_bfs.board = battle->board;
 
-    dx = (local_bfs.loc_width * dx);
-    dy = (loc_height * dy);
+    combatant_loop(&combatant_fill, un, &battle->game_vars, (void *)&local_bfs);
 
-    local_bfs.edgex = un->average[0] - (((facing.y * dx) + (facing.x * dy)) >> 10);
-    local_bfs.edgey = un->average[1] - (((facing.x * dx) - (facing.y * dy)) >> 10);
+    /* combatants take the slots in order, whatever order a sort left them in */
+    while (local_bfs.slot > 0) {
+        local_bfs.slot--;
+        un->slots[local_bfs.slot] = local_bfs.slot;
+    }
 
-    combatant_loop(&combatant_fill, un, gvar, (void *)&local_bfs);
+    /* filling gives wounds to every combatant placed, dead or not */
+    battle_living(un);
     battle_area(un);
 }
 
@@ -241,60 +667,78 @@ static n_int battle_calc_damage(n_int wounds, n_int damage) {
     return (wounds < 1) ? 0 : wounds;
 }
 
+/**
+ * Takes damage from wounds. Units attacking in parallel may share a target
+ * so the update is atomic, and as damage stops at zero the order is unimportant.
+ */
+static void battle_wound(n_byte *wounds, n_int damage, n_byte parallel) {
+#ifndef _WIN32
+    if (parallel) {
+        n_byte expected = __atomic_load_n(wounds, __ATOMIC_RELAXED);
+        while (!__atomic_compare_exchange_n(wounds, &expected, (n_byte)battle_calc_damage(expected, damage), 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+        }
+        return;
+    }
+#endif
+    *wounds = (n_byte)battle_calc_damage(*wounds, damage);
+}
+
+/**
+ * Splits the cycle's random key for a unit and the purpose of its rolls.
+ */
+static n_byte4 battle_random_key(n_battle *battle, n_unit *un, n_byte4 purpose) {
+    return math_random_key(math_random_key(battle->game_vars.random_key, (n_byte4)(un - battle->units)), purpose);
+}
+
 /**
  * Handles combatant attacks.
  */
-static void battle_combatant_attack(n_combatant *comb, n_combatant *comb_at, n_general_variables *gvar, void *additional_variables) {
-    const n_byte2 loc_attacking = comb->attacking;
-    const n_int distance_squared = comb->distance_squ;
-    n_int dice_roll = math_random(&gvar->random0) & 1023;
+static void battle_combatant_attack(n_unit *un, n_index num, void *comb_at, n_general_variables *gvar, void *additional_variables, n_int dice_roll) {
+    void *comb = un->combatants;
+    const n_index loc_attacking = COMBATANT_ATTACKING(comb, num);
+    const n_int distance_squared = COMBATANT_DISTANCE(comb, num);
 
-    if (comb->wounds == NUNIT_DEAD || loc_attacking == NUNIT_NO_ATTACK) {
+    if (COMBATANT_WOUNDS(comb, num) == NUNIT_DEAD || loc_attacking == NUNIT_NO_ATTACK) {
         return;
     }
 
-    comb_at = &comb_at[loc_attacking];
     n_additional_variables *av = (n_additional_variables *)additional_variables;
+    n_matchup *match = av->matchup;
 
     if (distance_squared < gvar->attack_melee_dsq) {
-        comb->speed_current = 0;
-        if (dice_roll < av->probability_melee) {
-            comb_at->wounds = (n_byte)battle_calc_damage(comb_at->wounds, av->damage_melee);
+        combatant_speed(un, num, 0);
+        if (dice_roll < match->probability_melee) {
+            battle_wound(&COMBATANT_WOUNDS(comb_at, loc_attacking), match->damage_melee, gvar->threads > 1);
         }
     } else if (distance_squared < av->range_missile) {
-        if (dice_roll < av->probability_missile) {
-            comb_at->wounds = (n_byte)battle_calc_damage(comb_at->wounds, av->damage_missile);
+        if (dice_roll < match->probability_missile) {
+            battle_wound(&COMBATANT_WOUNDS(comb_at, loc_attacking), match->damage_missile, gvar->threads > 1);
         }
     } else {
-        comb->speed_current = (n_byte)av->speed_max;
+        combatant_speed(un, num, (n_byte)av->speed_max);
     }
 }
 
 /**
- * Handles unit attacks.
+ * Returns the gap between two spans along an axis, zero when they overlap.
  */
-void battle_attack(n_unit *un, n_general_variables *gvar) {
-    n_additional_variables additional_variables;
-    n_uint loop = 0;
-    n_combatant *comb = (n_combatant *)(un->combatants);
-    n_combatant *comb_at;
-
-    if (un->unit_attacking == NOTHING) {
-        return;
+static n_int battle_span_gap(n_int low, n_int high, n_int other_low, n_int other_high) {
+    if (other_high < low) {
+        return low - other_high;
+    }
+    if (other_low > high) {
+        return other_low - high;
     }
+    return 0;
+}
 
-    n_int rang_missile = 0;
+/**
+ * Counts a unit's missile timer on by a cycle, returning the squared missile
+ * range when a volley is loosed and zero otherwise.
+ */
+static n_int battle_missile_range(n_unit *un) {
     n_type *typ = un->unit_type;
-    n_unit *un_at = un->unit_attacking;
-    n_type *typ_at = un_at->unit_type;
-    comb_at = un_at->combatants;
-
-    // Normalize the probability calculation to ensure fairness
-    additional_variables.probability_melee = (typ->melee_attack * (16 - typ_at->defence)) / 16;
-    additional_variables.probability_missile = (typ->missile_attack * (16 - typ_at->defence)) / 16;
-    additional_variables.damage_melee = typ->melee_damage;
-    additional_variables.damage_missile = typ->missile_damage;
-    additional_variables.speed_max = typ->speed_maximum;
+    n_int rang_missile = 0;
 
     if (un->missile_number != 0) {
         if (un->missile_timer == typ->missile_rate) {
@@ -306,20 +750,143 @@ void battle_attack(n_unit *un, n_general_variables *gvar) {
             un->missile_timer++;
         }
     }
+    return rang_missile;
+}
+
+/**
+ * Returns the chance out of 1024 of an attack striking home, the defence
+ * lowered by the attack's armour piercing.
+ */
+static n_int battle_matchup_probability(n_int attack, n_int defence, n_int armour_piercing) {
+    defence = (defence > armour_piercing) ? (defence - armour_piercing) : 0;
+    return (attack * (16 - defence)) / 16;
+}
+
+/**
+ * Builds the matchup of every unit type against every other. Called once
+ * the types are loaded, so the attacks only index the table.
+ */
+n_int battle_matchups(n_battle *battle) {
+    n_uint number = battle->number_types;
+    n_uint attacker = 0;
+
+    battle->matchups = (n_matchup *)mem_use(battle, sizeof(n_matchup) * number * number);
+    if (battle->matchups == NOTHING) {
+        return SHOW_ERROR("Matchups not allocated");
+    }
+    while (attacker < number) {
+        n_type *typ = &battle->types[attacker];
+        n_uint defender = 0;
+        while (defender < number) {
+            n_type *typ_at = &battle->types[defender];
+            n_matchup *match = &battle->matchups[(attacker * number) + defender];
+            match->probability_melee = battle_matchup_probability(typ->melee_attack, typ_at->defence, typ->melee_armpie);
+            match->probability_missile = battle_matchup_probability(typ->missile_attack, typ_at->defence, typ->missile_armpie);
+            match->damage_melee = typ->melee_damage;
+            match->damage_missile = typ->missile_damage;
+            defender++;
+        }
+        attacker++;
+    }
+    return 0;
+}
+
+/**
+ * Handles unit attacks.
+ */
+void battle_attack(n_battle *battle, n_unit *un) {
+    n_general_variables *gvar = &battle->game_vars;
+    n_additional_variables additional_variables;
+    n_index loop = 0;
+    void *comb = un->combatants;
+    void *comb_at;
+
+    if (un->unit_attacking == NOTHING) {
+        return;
+    }
+
+    n_int rang_missile;
+    n_type *typ = un->unit_type;
+    n_unit *un_at = un->unit_attacking;
+    n_int attacker = typ - battle->types;
+    n_int defender = (n_type *)un_at->unit_type - battle->types;
+    comb_at = un_at->combatants;
+
+    additional_variables.matchup = &battle->matchups[(attacker * battle->number_types) + defender];
+    additional_variables.speed_max = typ->speed_maximum;
+
+    rang_missile = battle_missile_range(un);
 
     additional_variables.range_missile = rang_missile;
 
-    while (loop < un->number_combatants) {
-        battle_combatant_attack(&comb[loop], comb_at, gvar, (void *)&additional_variables);
-        loop++;
+    /* broad phase, no combatant strikes when the areas are further apart than either reach */
+    if (un->engagement != BATTLE_FAR) {
+        n_int gap_x = battle_span_gap(un->area.top_left.x, un->area.bottom_right.x, un_at->area.top_left.x, un_at->area.bottom_right.x);
+        n_int gap_y = battle_span_gap(un->area.top_left.y, un->area.bottom_right.y, un_at->area.top_left.y, un_at->area.bottom_right.y);
+        n_int reach = (gvar->attack_melee_dsq > rang_missile) ? gvar->attack_melee_dsq : rang_missile;
+        un->engagement = (((gap_x * gap_x) + (gap_y * gap_y)) >= reach) ? BATTLE_APPROACHING : BATTLE_ENGAGED;
+    }
+
+    if (un->engagement != BATTLE_ENGAGED) {
+        /* those with a target close on it, far units have none */
+        if (un->engagement == BATTLE_APPROACHING) {
+            while (loop < un->living_count) {
+                n_index num = un->living[loop++];
+                if (COMBATANT_ATTACKING(comb, num) != NUNIT_NO_ATTACK) {
+                    combatant_speed(un, num, (n_byte)additional_variables.speed_max);
+                }
+            }
+        }
+        /* the shared stream still takes a roll for each combatant */
+        if (gvar->deterministic == 0) {
+            loop = 0;
+            while (loop < un->number_combatants) {
+                (void)math_random(&gvar->random0);
+                loop++;
+            }
+        }
+        return;
+    }
+
+    if (gvar->deterministic) {
+        n_byte4 random_key = battle_random_key(battle, un, BATTLE_RANDOM_ATTACK);
+
+        /* the rolls are keyed by combatant, so the dead are not visited */
+        while (loop < un->living_count) {
+            n_index num = un->living[loop++];
+            battle_combatant_attack(un, num, comb_at, gvar, (void *)&additional_variables, math_random_counter(random_key, num) & 1023);
+        }
+        return;
+    }
+
+    {
+        n_index rolled = 0;
+        while (loop < un->living_count) {
+            n_index num = un->living[loop++];
+            n_int dice_roll;
+
+            /* the shared stream still takes a roll for each dead combatant */
+            while (rolled < num) {
+                (void)math_random(&gvar->random0);
+                rolled++;
+            }
+            dice_roll = math_random(&gvar->random0) & 1023;
+            rolled++;
+            battle_combatant_attack(un, num, comb_at, gvar, (void *)&additional_variables, dice_roll);
+        }
+        while (rolled < un->number_combatants) {
+            (void)math_random(&gvar->random0);
+            rolled++;
+        }
     }
 }
 
 /**
  * Randomly adjusts a combatant's facing direction.
  */
-static n_int combatant_random_facing(n_int local_facing, n_general_variables *gvar) {
-    switch (math_random(&gvar->random0) & 31) {
+static n_int combatant_random_facing(n_int local_facing, n_general_variables *gvar, n_byte4 random_key, n_index num) {
+    n_byte4 roll = gvar->deterministic ? math_random_counter(random_key, num) : math_random(&gvar->random0);
+    switch (roll & 31) {
         case 1: return (local_facing + 1) & 255;
         case 2: return (local_facing + 255) & 255;
         case 3: return (local_facing + 2) & 255;
@@ -327,79 +894,264 @@ static n_int combatant_random_facing(n_int local_facing, n_general_variables *gv
     }
 }
 
+/**
+ * Builds the spatial index of a unit's living combatants for this tick.
+ */
+void battle_grid(n_battle *battle, n_unit *un) {
+    n_general_variables *gvar = &battle->game_vars;
+    n_grid *grid = &un->grid;
+    void *comb = un->combatants;
+    n_int left, top, right, bottom;
+    n_int cells, loop = 0;
+
+    grid->width = 0;
+
+    if ((gvar->declare_method == DECLARE_LINEAR) || (un->number_living == 0)) {
+        return;
+    }
+
+    left = un->area.top_left.x >> BATTLE_GRID_SHIFT;
+    top = un->area.top_left.y >> BATTLE_GRID_SHIFT;
+    right = un->area.bottom_right.x >> BATTLE_GRID_SHIFT;
+    bottom = un->area.bottom_right.y >> BATTLE_GRID_SHIFT;
+
+    left = (left < 0) ? 0 : ((left >= BATTLE_GRID_WIDTH) ? (BATTLE_GRID_WIDTH - 1) : left);
+    top = (top < 0) ? 0 : ((top >= BATTLE_GRID_HEIGHT) ? (BATTLE_GRID_HEIGHT - 1) : top);
+    right = (right < left) ? left : ((right >= BATTLE_GRID_WIDTH) ? (BATTLE_GRID_WIDTH - 1) : right);
+    bottom = (bottom < top) ? top : ((bottom >= BATTLE_GRID_HEIGHT) ? (BATTLE_GRID_HEIGHT - 1) : bottom);
+
+    grid->left = (n_byte2)left;
+    grid->top = (n_byte2)top;
+    grid->width = (n_byte2)(right - left + 1);
+    grid->height = (n_byte2)(bottom - top + 1);
+
+    cells = grid->width * grid->height;
+    memory_erase((n_byte *)grid->start, sizeof(n_index) * (cells + 1));
+
+    /* count the living combatants in each cell */
+    while (loop < un->living_count) {
+        n_int num = un->living[loop];
+        n_int px = (COMBATANT_X(comb, num) >> BATTLE_GRID_SHIFT) - left;
+        n_int py = (COMBATANT_Y(comb, num) >> BATTLE_GRID_SHIFT) - top;
+        px = (px < 0) ? 0 : ((px >= grid->width) ? (grid->width - 1) : px);
+        py = (py < 0) ? 0 : ((py >= grid->height) ? (grid->height - 1) : py);
+        grid->start[(py * grid->width) + px + 1]++;
+        loop++;
+    }
+
+    loop = 0;
+    while (loop < cells) {
+        grid->start[loop + 1] += grid->start[loop];
+        loop++;
+    }
+
+    /* place the indices, ascending within each cell */
+    loop = 0;
+    while (loop < un->living_count) {
+        n_int num = un->living[loop];
+        n_int px = (COMBATANT_X(comb, num) >> BATTLE_GRID_SHIFT) - left;
+        n_int py = (COMBATANT_Y(comb, num) >> BATTLE_GRID_SHIFT) - top;
+        px = (px < 0) ? 0 : ((px >= grid->width) ? (grid->width - 1) : px);
+        py = (py < 0) ? 0 : ((py >= grid->height) ? (grid->height - 1) : py);
+        grid->order[grid->start[(py * grid->width) + px]++] = (n_index)num;
+        loop++;
+    }
+
+    /* placing shifted each start onto the next cell, shift back */
+    loop = cells;
+    while (loop > 0) {
+        grid->start[loop] = grid->start[loop - 1];
+        loop--;
+    }
+    grid->start[0] = 0;
+}
+
+/**
+ * Finds the attack target in front of a combatant through the target unit's grid.
+ *
+ * The linear scan keeps the nearest combatant in front, the first in scan order
+ * (reversed for reverso) on a tie, over every combatant. DECLARE_GRID_EXACT gives
+ * that same answer by visiting cell rings outward until no closer or equal
+ * candidate can remain. DECLARE_GRID_NEAREST stops at the first ring that
+ * holds a combatant under declare_close_enough_dsq.
+ */
+static n_index battle_grid_search(n_vect2 *loc, n_vect2 *facing, n_unit *un_at, n_byte reverso, n_general_variables *gvar, n_distance *distance_squ) {
+    n_grid *grid = &un_at->grid;
+    void *comb_at = un_at->combatants;
+    n_int close_enough = gvar->declare_close_enough_dsq;
+    n_int max_distance = gvar->declare_max_start_dsq;
+    n_int best_distance = max_distance;
+    n_int best = NUNIT_NO_ATTACK;
+    n_byte exact = (gvar->declare_method == DECLARE_GRID_EXACT);
+
+    n_int qx = loc->x >> BATTLE_GRID_SHIFT;
+    n_int qy = loc->y >> BATTLE_GRID_SHIFT;
+    n_int left = grid->left;
+    n_int top = grid->top;
+    n_int right = left + grid->width - 1;
+    n_int bottom = top + grid->height - 1;
+
+    n_int dx_near = (qx < left) ? (left - qx) : ((qx > right) ? (qx - right) : 0);
+    n_int dy_near = (qy < top) ? (top - qy) : ((qy > bottom) ? (qy - bottom) : 0);
+    n_int dx_far = ((qx - left) > (right - qx)) ? (qx - left) : (right - qx);
+    n_int dy_far = ((qy - top) > (bottom - qy)) ? (qy - top) : (bottom - qy);
+
+    n_int ring = (dx_near > dy_near) ? dx_near : dy_near;
+    n_int ring_max = (dx_far > dy_far) ? dx_far : dy_far;
+
+    while (ring <= ring_max) {
+        n_int bound = (ring == 0) ? 0 : (((ring - 1) * BATTLE_GRID_CELL) + 1);
+        n_int cy;
+
+        bound *= bound;
+
+        if (bound >= max_distance) {
+            break;
+        }
+        if (bound > best_distance) {
+            break;
+        }
+        if ((exact == 0) && (best_distance < close_enough)) {
+            break;
+        }
+
+        cy = qy - ring;
+        while (cy <= qy + ring) {
+            n_int edge_row = ((cy == qy - ring) || (cy == qy + ring));
+            n_int cx = qx - ring;
+            n_int cx_step = edge_row ? 1 : (ring << 1);
+
+            if ((cy >= top) && (cy <= bottom)) {
+                while (cx <= qx + ring) {
+                    if ((cx >= left) && (cx <= right)) {
+                        n_int cell_x = cx << BATTLE_GRID_SHIFT;
+                        n_int cell_y = cy << BATTLE_GRID_SHIFT;
+
+                        /* skip cells entirely behind the combatant */
+                        n_int corner_x = (facing->x > 0) ? (cell_x + BATTLE_GRID_CELL - 1) : cell_x;
+                        n_int corner_y = (facing->y > 0) ? (cell_y + BATTLE_GRID_CELL - 1) : cell_y;
+                        n_int corner_facing = ((corner_x - loc->x) * facing->x) + ((corner_y - loc->y) * facing->y);
+
+                        /* and cells further than the best so far */
+                        n_int near_x = (loc->x < cell_x) ? (cell_x - loc->x) : ((loc->x >= cell_x + BATTLE_GRID_CELL) ? (loc->x - cell_x - BATTLE_GRID_CELL + 1) : 0);
+                        n_int near_y = (loc->y < cell_y) ? (cell_y - loc->y) : ((loc->y >= cell_y + BATTLE_GRID_CELL) ? (loc->y - cell_y - BATTLE_GRID_CELL + 1) : 0);
+                        n_int near_squared = (near_x * near_x) + (near_y * near_y);
+
+                        if ((corner_facing > 0) && (near_squared <= best_distance) && (near_squared < max_distance)) {
+                            n_int cell = ((cy - top) * grid->width) + (cx - left);
+                            n_int loop = grid->start[cell];
+                            n_int end = grid->start[cell + 1];
+
+                            while (loop < end) {
+                                n_int loc_test = grid->order[loop];
+                                n_vect2 distance;
+                                n_int distance_squared, distance_facing;
+
+                                vect2_populate(&distance, COMBATANT_X(comb_at, loc_test) - loc->x, COMBATANT_Y(comb_at, loc_test) - loc->y);
+                                distance_squared = vect2_dot(&distance, &distance, 1, 1);
+                                distance_facing = vect2_dot(&distance, facing, 1, 1);
+
+                                if ((distance_squared < max_distance) && (distance_facing > 0)) {
+                                    n_byte earlier = (best == NUNIT_NO_ATTACK) || (reverso ? (loc_test > best) : (loc_test < best));
+
+                                    if ((distance_squared < best_distance) || (exact && (distance_squared == best_distance) && earlier)) {
+                                        best_distance = distance_squared;
+                                        best = loc_test;
+                                    }
+                                }
+                                loop++;
+                            }
+                        }
+                    }
+                    cx += cx_step;
+                }
+            }
+            cy++;
+        }
+        ring++;
+    }
+
+    *distance_squ = BATTLE_DISTANCE(best_distance);
+    return (n_index)best;
+}
+
 /**
  * Declares a combatant's attack target.
  */
-static void battle_combatant_declare(n_combatant *comb, n_general_variables *gvar, n_unit *un_at, n_byte reverso, n_byte group_facing) {
-    n_int loc_f = comb->direction_facing;
-    n_byte2 loc_attack = NUNIT_NO_ATTACK;
-    n_byte2 max_distance_squared = gvar->declare_max_start_dsq;
-    n_vect2 *loc = &comb->location;
-    n_combatant *comb_at = un_at->combatants;
+static void battle_combatant_declare(void *comb, n_index num, n_general_variables *gvar, n_unit *un_at, n_byte reverso, n_byte group_facing, n_byte4 random_key) {
+    n_int loc_f = COMBATANT_FACING(comb, num);
+    n_index loc_attack = NUNIT_NO_ATTACK;
+    n_distance max_distance_squared = gvar->declare_max_start_dsq;
+    n_vect2 location;
+    n_vect2 *loc = &location;
+    void *comb_at = un_at->combatants;
+
+    COMBATANT_LOCATION(comb, num, loc);
 
     n_vect2 average, delta;
     vect2_populate(&average, un_at->average[0], un_at->average[1]);
     vect2_subtract(&delta, loc, &average);
     n_int distance_centre_squ = vect2_dot(&delta, &delta, 1, 1);
 
-    if (comb->wounds == NUNIT_DEAD) {
-        return;
-    }
-
     if (distance_centre_squ < gvar->declare_one_to_one_dsq) {
         n_vect2 facing;
-        n_byte2 loop2 = 0;
+        n_index loop2 = 0;
         vect2_direction(&facing, loc_f, 32);
 
-        while (loop2 < un_at->number_combatants) {
-            n_byte2 loc_test = reverso ? (un_at->number_combatants - 1 - loop2) : loop2;
+        if (un_at->grid.width != 0) {
+            loc_attack = battle_grid_search(loc, &facing, un_at, reverso, gvar, &max_distance_squared);
+            loop2 = un_at->living_count;
+        }
 
-            if (comb_at[loc_test].wounds != NUNIT_DEAD) {
-                n_vect2 distance;
-                vect2_subtract(&distance, &comb_at[loc_test].location, loc);
-                n_int distance_squared = vect2_dot(&distance, &distance, 1, 1);
-                n_int distance_facing = vect2_dot(&distance, &facing, 1, 1);
+        while (loop2 < un_at->living_count) {
+            n_index loc_test = un_at->living[reverso ? (un_at->living_count - 1 - loop2) : loop2];
+            n_vect2 distance;
+            vect2_populate(&distance, COMBATANT_X(comb_at, loc_test) - loc->x, COMBATANT_Y(comb_at, loc_test) - loc->y);
+            n_int distance_squared = vect2_dot(&distance, &distance, 1, 1);
+            n_int distance_facing = vect2_dot(&distance, &facing, 1, 1);
 
-                if ((distance_squared < max_distance_squared) && (distance_facing > 0)) {
-                    max_distance_squared = (n_byte2)distance_squared;
-                    loc_attack = loc_test;
-                    if (max_distance_squared < gvar->declare_close_enough_dsq) {
-                        loop2 += 0xFFFF;
-                    }
-                }
+            if ((distance_squared < max_distance_squared) && (distance_facing > 0)) {
+                max_distance_squared = BATTLE_DISTANCE(distance_squared);
+                loc_attack = loc_test;
             }
             loop2++;
         }
     }
 
-    comb->attacking = loc_attack;
-    comb->distance_squ = max_distance_squared;
+    COMBATANT_ATTACKING(comb, num) = loc_attack;
+    COMBATANT_DISTANCE(comb, num) = max_distance_squared;
 
     if (group_facing == 255) {
         if (loc_attack != NUNIT_NO_ATTACK) {
             n_vect2 delta;
-            vect2_subtract(&delta, &comb_at[loc_attack].location, loc);
+            vect2_populate(&delta, COMBATANT_X(comb_at, loc_attack) - loc->x, COMBATANT_Y(comb_at, loc_attack) - loc->y);
             group_facing = math_tan(&delta);
         } else {
-            group_facing = combatant_random_facing(group_facing, gvar);
+            group_facing = combatant_random_facing(group_facing, gvar, random_key, num);
         }
     }
-    comb->direction_facing = group_facing;
+    COMBATANT_FACING(comb, num) = group_facing;
 }
 
 /**
  * Declares attacks for all combatants in a unit.
  */
-void battle_declare(n_unit *un, n_general_variables *gvar) {
-    n_uint loop = 0;
+void battle_declare(n_battle *battle, n_unit *un) {
+    n_general_variables *gvar = &battle->game_vars;
+    n_index loop = 0;
     n_byte group_facing = 255;
-    n_combatant *comb = un->combatants;
+    void *comb = un->combatants;
     n_unit *un_at = un->unit_attacking;
+    n_byte4 random_key;
+
+    un->engagement = BATTLE_FAR;
 
     if (un_at == NOTHING) {
         return;
     }
 
+    random_key = battle_random_key(battle, un, BATTLE_RANDOM_FACING);
+
     n_int delta_x = un_at->average[0] - un->average[0];
     n_int delta_y = un_at->average[1] - un->average[1];
     n_vect2 delta = {delta_x, delta_y};
@@ -408,155 +1160,492 @@ void battle_declare(n_unit *un, n_general_variables *gvar) {
         group_facing = math_tan(&delta);
     }
 
-    while (loop < un->number_combatants) {
-        n_byte reverso = (loop > (un->number_combatants >> 1));
-        battle_combatant_declare(&comb[loop], gvar, un_at, reverso, group_facing);
-        loop++;
+    /* broad phase, no combatant declares when the unit's area is too far from the target's average */
+    {
+        n_int gap_x = battle_span_gap(un->area.top_left.x, un->area.bottom_right.x, un_at->average[0], un_at->average[0]);
+        n_int gap_y = battle_span_gap(un->area.top_left.y, un->area.bottom_right.y, un_at->average[1], un_at->average[1]);
+        if (((gap_x * gap_x) + (gap_y * gap_y)) < gvar->declare_one_to_one_dsq) {
+            un->engagement = BATTLE_ENGAGED;
+        }
+    }
+
+    if (un->engagement == BATTLE_FAR) {
+        /* steer the whole unit, without a target each takes the group facing */
+        while (loop < un->living_count) {
+            n_index num = un->living[loop++];
+            COMBATANT_ATTACKING(comb, num) = NUNIT_NO_ATTACK;
+            COMBATANT_DISTANCE(comb, num) = gvar->declare_max_start_dsq;
+            COMBATANT_FACING(comb, num) = (group_facing == 255) ? (n_byte)combatant_random_facing(group_facing, gvar, random_key, num) : group_facing;
+        }
+        return;
+    }
+
+    while (loop < un->living_count) {
+        n_index num = un->living[loop++];
+        n_byte reverso = (num > (un->number_combatants >> 1));
+        battle_combatant_declare(comb, num, gvar, un_at, reverso, group_facing, random_key);
     }
 }
 
 /**
- * Marks a combatant as dead.
+ * Marks a combatant as dead and takes it out of the unit's area.
  */
-void combatant_dead(n_combatant *comb) {
-    comb->wounds = NUNIT_DEAD;
-    comb->speed_current = 0;
-    comb->attacking = NUNIT_NO_ATTACK;
+void combatant_dead(n_unit *un, n_index num) {
+    void *comb = un->combatants;
+    n_vect2 location;
+    COMBATANT_LOCATION(comb, num, &location);
+    battle_area_remove(un, &location);
+    combatant_speed(un, num, 0);
+    COMBATANT_WOUNDS(comb, num) = NUNIT_DEAD;
+    COMBATANT_ATTACKING(comb, num) = NUNIT_NO_ATTACK;
 }
 
 /**
- * Moves a combatant on the battle board.
+ * Moves a combatant on the battle board by its speed over a number of cycles.
  */
-static void combatant_move(n_combatant *comb, n_general_variables *gvar, void *values) {
-    n_int local_speed = comb->speed_current;
-    n_int local_facing = comb->direction_facing;
-    n_vect2 old_location, temp_location, facing;
-
-    vect2_copy(&old_location, &comb->location);
-    vect2_copy(&temp_location, &old_location);
-
-    if (comb->wounds == NUNIT_DEAD || local_speed == 0) {
-        return;
+static n_byte combatant_destination(n_unit *un, n_index num, n_int cycles, n_vect2 *old_location, n_vect2 *new_location) {
+    void *comb = un->combatants;
+    n_index loc_attacking = COMBATANT_ATTACKING(comb, num);
+    n_int local_speed = COMBATANT_SPEED(comb, num);
+    n_int local_facing = COMBATANT_FACING(comb, num);
+    n_vect2 temp_location, facing;
+
+    if (local_speed == 0) {
+        return 0;
     }
 
+    COMBATANT_LOCATION(comb, num, old_location);
+    vect2_copy(&temp_location, old_location);
+
     // Move toward the attacker if one is set
-    if (comb->attacking != NUNIT_NO_ATTACK && values != NOTHING) { // <-- Add check for NOTHING
-        n_unit *un = (n_unit *)values;
+    if (loc_attacking != NUNIT_NO_ATTACK) {
         n_unit *un_at = un->unit_attacking;
-        if (un_at != NOTHING) {
-            n_combatant *comb_at = un_at->combatants;
+        // The target unit may have changed since the attack was declared
+        if ((un_at != NOTHING) && (loc_attacking < un_at->number_combatants)) {
+            void *comb_at = un_at->combatants;
             n_vect2 delta;
-            vect2_subtract(&delta, &comb_at[comb->attacking].location, &comb->location);
+            vect2_populate(&delta, COMBATANT_X(comb_at, loc_attacking) - old_location->x, COMBATANT_Y(comb_at, loc_attacking) - old_location->y);
             local_facing = math_tan(&delta);
         }
     }
 
     vect2_direction(&facing, local_facing, 1);
-    vect2_d(&temp_location, &facing, local_speed, 26880);
+    vect2_d(&temp_location, &facing, local_speed * cycles, 26880);
 
     if (OUTSIDE_HEIGHT(temp_location.y) || OUTSIDE_WIDTH(temp_location.x)) {
-        temp_location = old_location;
+        if (cycles == 1) {
+            temp_location = *old_location;
+        } else {
+            /* over several cycles the combatant would have stopped at the edge */
+            temp_location.x = (temp_location.x < 0) ? 0 : ((temp_location.x >= BATTLE_BOARD_WIDTH) ? (BATTLE_BOARD_WIDTH - 1) : temp_location.x);
+            temp_location.y = (temp_location.y < 0) ? 0 : ((temp_location.y >= BATTLE_BOARD_HEIGHT) ? (BATTLE_BOARD_HEIGHT - 1) : temp_location.y);
+        }
     }
 
-    if (old_location.x != temp_location.x || old_location.y != temp_location.y) {
-        if (board_move(&old_location, &temp_location)) {
-            vect2_copy(&comb->location, &temp_location);
+    COMBATANT_FACING(comb, num) = (n_byte)local_facing;
+    COMBATANT_SPEED(comb, num) = (n_byte)local_speed;
+
+    *new_location = temp_location;
+    return (old_location->x != temp_location.x) || (old_location->y != temp_location.y);
+}
+
+/**
+ * Moves a combatant on the board toward its destination. With MOVE_CONCURRENT
+ * the units move on several threads at once and the board is claimed cell
+ * by cell, so the outcome depends on how the threads interleave.
+ */
+static void combatant_move(n_battle *battle, n_unit *un, n_index num, n_int cycles) {
+    void *comb = un->combatants;
+    n_vect2 old_location, temp_location;
+
+    if (combatant_destination(un, num, cycles, &old_location, &temp_location)) {
+        n_byte moved = (battle->game_vars.move_method == MOVE_CONCURRENT) ?
+                       board_move_atomic(battle->board, &old_location, &temp_location) :
+                       board_move(battle->board, &old_location, &temp_location);
+        if (moved) {
+            COMBATANT_SET_LOCATION(comb, num, &temp_location);
+            battle_area_insert(un, &temp_location);
+            battle_area_remove(un, &old_location);
         }
     }
-
-    comb->direction_facing = (n_byte)local_facing;
-    comb->speed_current = (n_byte)local_speed;
 }
 
 /**
  * Moves all combatants in a unit.
  */
-void battle_move(n_unit *un, n_general_variables *gvar) {
-    combatant_loop(&combatant_move, un, gvar, (void *)un); // <-- Pass the current unit as values
-    battle_area(un);
+void battle_move(n_battle *battle, n_unit *un) {
+    n_index loop = 0;
+    while (loop < un->living_count) {
+        combatant_move(battle, un, un->living[loop++], 1);
+    }
+#ifdef SIMULATED_APE_ASSERT
+    battle_area_check(un);
+#endif
 }
 
 /**
- * Removes dead combatants from the battle.
+ * The claim of a combatant on a cell with MOVE_PROPOSE. Claims are unique
+ * and the lowest unit then the lowest combatant makes the strongest.
  */
-void battle_remove_dead(n_unit *un, n_general_variables *gvar) {
-    n_combatant *comb = (n_combatant *)(un->combatants);
-    n_vect2 sum = {0};
-    n_int count = 0;
-    n_byte2 loop = 0;
+static n_claim battle_move_claim(n_battle *battle, n_unit *un, n_index num) {
+    n_claim unit = (n_claim)(un - battle->units);
+    return (n_claim)(~(n_claim)0 - ((unit << BATTLE_INDEX_BITS) | num));
+}
 
-    while (loop < un->number_combatants) {
-        if (comb[loop].wounds != NUNIT_DEAD) {
-            if (comb[loop].wounds == 0) {
-                combatant_dead(&comb[loop]);
-                board_clear(&comb[loop].location);
-            } else {
-                vect2_d(&sum, &comb[loop].location, 1, 1);
-                count++;
+/**
+ * Proposes a cell for every moving combatant in a unit, the first pass of
+ * MOVE_PROPOSE. Each combatant reads the board as it was before any move
+ * this cycle and claims the nearest free cell to its destination, keeping
+ * the strongest claim on each cell, so units may propose in parallel and in
+ * any order.
+ */
+void battle_move_propose(n_battle *battle, n_unit *un) {
+    n_index loop = 0;
+    while (loop < un->living_count) {
+        n_index num = un->living[loop++];
+        n_vect2 old_location, temp_location;
+
+        un->moves[num] = BATTLE_MOVE_NONE;
+        if (combatant_destination(un, num, 1, &old_location, &temp_location) && board_find(battle->board, &temp_location)) {
+            n_claim *claim = &battle->claims[(temp_location.y * BATTLE_BOARD_WIDTH) + temp_location.x];
+            n_claim value = battle_move_claim(battle, un, num);
+#ifndef _WIN32
+            n_claim expected = __atomic_load_n(claim, __ATOMIC_RELAXED);
+            while ((expected < value) &&
+                   (__atomic_compare_exchange_n(claim, &expected, value, 0, __ATOMIC_RELAXED, __ATOMIC_RELAXED) == 0)) {
+                /* expected now holds the claim that got in first */
             }
+#else
+            if (*claim < value) {
+                *claim = value;
+            }
+#endif
+            un->moves[num] = (n_byte4)((temp_location.y << 16) | temp_location.x);
+        }
+    }
+}
+
+/**
+ * Commits the moves of a unit's combatants that hold the claim on their
+ * cell, the second pass of MOVE_PROPOSE. The others stay where they are.
+ * Each winner clears its claim, which no other combatant can hold, ready
+ * for the next cycle.
+ */
+void battle_move_commit(n_battle *battle, n_unit *un) {
+    void *comb = un->combatants;
+    n_index loop = 0;
+    while (loop < un->living_count) {
+        n_index num = un->living[loop++];
+        n_byte4 move = un->moves[num];
+        if (move != BATTLE_MOVE_NONE) {
+            n_vect2 old_location, new_location = {move & 0xffff, move >> 16};
+            n_claim *claim = &battle->claims[(new_location.y * BATTLE_BOARD_WIDTH) + new_location.x];
+            if (*claim == battle_move_claim(battle, un, num)) {
+                *claim = 0;
+                COMBATANT_LOCATION(comb, num, &old_location);
+                board_commit(battle->board, &old_location, &new_location);
+                COMBATANT_SET_LOCATION(comb, num, &new_location);
+                battle_area_insert(un, &new_location);
+                battle_area_remove(un, &old_location);
+            }
+        }
+    }
+#ifdef SIMULATED_APE_ASSERT
+    battle_area_check(un);
+#endif
+}
+
+/**
+ * Removes dead combatants from the battle, closing them out of the living list.
+ */
+void battle_remove_dead(n_battle *battle, n_unit *un) {
+    void *comb = un->combatants;
+    n_int count = 0;
+    n_index loop = 0;
+
+    while (loop < un->living_count) {
+        n_index num = un->living[loop++];
+        if (COMBATANT_WOUNDS(comb, num) == 0) {
+            n_vect2 location;
+            COMBATANT_LOCATION(comb, num, &location);
+            combatant_dead(un, num);
+            board_clear(battle->board, &location);
+        } else {
+            un->living[count++] = num;
         }
-        loop++;
     }
+    un->living_count = (n_index)count;
 
     if (count != 0) {
-        un->average[0] = (n_byte2)(sum.x / count);
-        un->average[1] = (n_byte2)(sum.y / count);
+        un->average[0] = (n_byte2)(un->location_sum.x / count);
+        un->average[1] = (n_byte2)(un->location_sum.y / count);
     }
     un->number_living = count;
+#ifdef SIMULATED_APE_ASSERT
+    battle_area_check(un);
+#endif
+}
+
+/**
+ * Spreads the low 16 bits of a value to the even bits, half a Z-order key.
+ */
+static n_uint battle_morton_spread(n_uint value) {
+    value &= 0xffff;
+    value = (value | (value << 8)) & 0x00ff00ff;
+    value = (value | (value << 4)) & 0x0f0f0f0f;
+    value = (value | (value << 2)) & 0x33333333;
+    value = (value | (value << 1)) & 0x55555555;
+    return value;
+}
+
+static int battle_sort_compare(const void *a, const void *b) {
+    n_byte8 first = *(const n_byte8 *)a;
+    n_byte8 second = *(const n_byte8 *)b;
+    return (first > second) - (first < second);
+}
+
+/**
+ * Puts a unit's living combatants in Z-order of their locations, so those
+ * near each other on the board are near each other in memory, with the
+ * dead after them in their old order. Each combatant keeps its formation
+ * slot, and the targets of the units attacking this one are renumbered to
+ * match. Units must be sorted one at a time.
+ */
+void battle_sort(n_battle *battle, n_unit *un) {
+    void *comb = un->combatants;
+    n_byte8 *keys = battle->sort_keys;
+    n_index *remap = battle->sort_remap;
+    n_index *slots = battle->sort_slots;
+    n_combatant *copy = battle->sort_combatants;
+    n_index number = un->number_combatants;
+    n_index loop = 0;
+    n_byte2 unit = 0;
+
+    if ((keys == NOTHING) || (un->living_count < 2)) {
+        return;
+    }
+
+    /* the key holds the combatant below its location's order, so no two are equal */
+    while (loop < number) {
+        n_byte8 key = 0xffffffff;
+        if (COMBATANT_WOUNDS(comb, loop) != NUNIT_DEAD) {
+            key = battle_morton_spread(COMBATANT_X(comb, loop)) | (battle_morton_spread(COMBATANT_Y(comb, loop)) << 1);
+        }
+        keys[loop] = (key << 32) | loop;
+        combatant_get(un, loop, &copy[loop]);
+        loop++;
+    }
+    qsort(keys, number, sizeof(n_byte8), &battle_sort_compare);
+
+    loop = 0;
+    while (loop < number) {
+        n_index old = (n_index)(keys[loop] & 0xffffffff);
+        remap[old] = loop;
+        slots[loop] = un->slots[old];
+        combatant_set(un, loop, &copy[old]);
+        loop++;
+    }
+    memory_copy((n_byte *)slots, (n_byte *)un->slots, sizeof(n_index) * number);
+
+#ifdef SIMULATED_APE_ASSERT
+    loop = 0;
+    while (loop < number) {
+        NA_ASSERT((COMBATANT_X(comb, remap[loop]) == copy[loop].location.x) &&
+                  (COMBATANT_Y(comb, remap[loop]) == copy[loop].location.y), "combatant lost in sort");
+        loop++;
+    }
+#endif
+
+    while (unit < battle->number_units) {
+        n_unit *un_from = &battle->units[unit++];
+        if (un_from->unit_attacking == un) {
+            void *comb_from = un_from->combatants;
+            loop = 0;
+            while (loop < un_from->number_combatants) {
+                n_index target = COMBATANT_ATTACKING(comb_from, loop);
+                if (target < number) {
+                    COMBATANT_ATTACKING(comb_from, loop) = remap[target];
+                }
+                loop++;
+            }
+        }
+    }
+
+    battle_living(un);
+}
+
+/**
+ * Returns the furthest any living unit's average has moved since the
+ * snapshot, measured along both axes.
+ */
+static n_int battle_ranking_slack(n_battle *battle) {
+    n_unit *un = battle->units;
+    n_uint loop = 0;
+    n_int slack = 0;
+
+    while (loop < battle->number_units) {
+        if (un[loop].number_living > 0) {
+            n_int dx = un[loop].average[0] - un[loop].ranked_average[0];
+            n_int dy = un[loop].average[1] - un[loop].ranked_average[1];
+            n_int moved = ((dx < 0) ? -dx : dx) + ((dy < 0) ? -dy : dy);
+            if (moved > slack) {
+                slack = moved;
+            }
+        }
+        loop++;
+    }
+    return slack;
+}
+
+/**
+ * Takes a new snapshot of the unit averages, leaving every ranking out of date.
+ */
+static void battle_ranking_snapshot(n_battle *battle) {
+    n_unit *un = battle->units;
+    n_uint loop = 0;
+
+    while (loop < battle->number_units) {
+        un[loop].ranked_average[0] = un[loop].average[0];
+        un[loop].ranked_average[1] = un[loop].average[1];
+        loop++;
+    }
+    battle->ranking_epoch++;
+    if (battle->ranking_epoch == 0) {
+        battle->ranking_epoch = 1;
+    }
+}
+
+/**
+ * Ranks the enemy units of a unit by the distance between their averages in
+ * the snapshot, nearest first.
+ */
+static void battle_ranking(n_battle *battle, n_uint index) {
+    n_unit *un = battle->units;
+    n_rank *ranking = un[index].ranking;
+    n_int local_alignment = un[index].alignment & 1;
+    n_int px = un[index].ranked_average[0];
+    n_int py = un[index].ranked_average[1];
+    n_uint count = 0;
+    n_uint loop = 0;
+
+    while (loop < battle->number_units) {
+        if (((un[loop].alignment) & 1) != local_alignment) {
+            n_int tx = un[loop].ranked_average[0];
+            n_int ty = un[loop].ranked_average[1];
+            n_byte4 dist_squ = (n_byte4)((tx - px) * (tx - px) + (ty - py) * (ty - py));
+            n_uint place = count++;
+
+            while ((place > 0) && (ranking[place - 1].distance_squ > dist_squ)) {
+                ranking[place] = ranking[place - 1];
+                place--;
+            }
+            ranking[place].distance_squ = dist_squ;
+            ranking[place].unit = (n_byte2)loop;
+        }
+        loop++;
+    }
+    un[index].ranking_count = (n_byte2)count;
+    un[index].ranking_epoch = battle->ranking_epoch;
+}
+
+/**
+ * Finds the nearest living enemy unit to a unit by checking every unit.
+ */
+static n_unit *battle_nearest_scan(n_battle *battle, n_uint index) {
+    n_unit *un = battle->units;
+    n_int local_alignment = un[index].alignment & 1;
+    n_int px = un[index].average[0];
+    n_int py = un[index].average[1];
+    n_uint min_dist_squ = BIG_INTEGER;
+    n_unit *nearest = NOTHING;
+    n_uint loop = 0;
+
+    while (loop < battle->number_units) {
+        if (index != loop && un[loop].number_living) {
+            if (((un[loop].alignment) & 1) != local_alignment) {
+                n_int tx = un[loop].average[0];
+                n_int ty = un[loop].average[1];
+                n_uint dist_squ = (n_uint)((tx - px) * (tx - px) + (ty - py) * (ty - py));
+
+                if (dist_squ < min_dist_squ) {
+                    min_dist_squ = dist_squ;
+                    nearest = &un[loop];
+                }
+            }
+        }
+        loop++;
+    }
+    return nearest;
+}
+
+/**
+ * Finds the nearest living enemy unit to a unit from its ranking. Averages
+ * that have moved by up to slack each since the snapshot can change a
+ * distance by twice that, so the first living enemy ranked is only taken
+ * when its lead over the next living one is larger than any such change.
+ * Otherwise every unit is checked.
+ */
+static n_unit *battle_nearest_enemy(n_battle *battle, n_uint index, n_int slack) {
+    n_unit *un = battle->units;
+    n_rank *ranking = un[index].ranking;
+    n_rank *first = NOTHING;
+    n_uint loop = 0;
+
+    if (un[index].ranking_epoch != battle->ranking_epoch) {
+        battle_ranking(battle, index);
+    }
+
+    while (loop < un[index].ranking_count) {
+        if (un[ranking[loop].unit].number_living) {
+            if (first == NOTHING) {
+                first = &ranking[loop];
+            } else if ((math_root(first->distance_squ) + 1 + (4 * slack)) <= math_root(ranking[loop].distance_squ)) {
+                break;
+            } else {
+                return battle_nearest_scan(battle, index);
+            }
+        }
+        loop++;
+    }
+    if (first == NOTHING) {
+        return NOTHING;
+    }
+    return &un[first->unit];
 }
 
 /**
  * Determines the status of the battle opponents.
  */
-n_byte battle_opponent(n_unit *un, n_uint num, n_uint *no_movement) {
+n_byte battle_opponent(n_battle *battle) {
+    n_unit *un = battle->units;
+    n_uint num = battle->number_units;
     n_uint loop = 0;
     n_uint unit_count[2] = {0};
     n_uint unit_movement[2] = {0};
+    n_int slack = 0;
+
+    if (battle->ranking_epoch != 0) {
+        slack = battle_ranking_slack(battle);
+    }
+    if ((battle->ranking_epoch == 0) || (slack > BATTLE_RANKING_SLACK)) {
+        battle_ranking_snapshot(battle);
+        slack = 0;
+    }
 
     while (loop < num) {
         if (un[loop].number_living > 0) {
             n_unit *un_att = un[loop].unit_attacking;
             n_int local_alignment = un[loop].alignment & 1;
-            n_combatant *combatants = (n_combatant *)un[loop].combatants;
-            n_uint number_combatants = un[loop].number_combatants;
-            n_uint loop2 = 0;
-            n_uint movement = 0;
-
-            while (loop2 < number_combatants) {
-                if (combatants[loop2].speed_current != 0) {
-                    movement = 1;
-                }
-                loop2++;
-            }
 
             unit_count[local_alignment]++;
-            unit_movement[local_alignment] += movement;
+            unit_movement[local_alignment] += (un[loop].moving != 0);
 
             if (un_att != NOTHING && un_att->number_living == 0) {
                 un_att = NOTHING;
             }
 
             if (un_att == NOTHING) {
-                n_int px = un[loop].average[0];
-                n_int py = un[loop].average[1];
-                n_uint min_dist_squ = BIG_INTEGER;
-                n_uint loop2 = 0;
-
-                while (loop2 < num) {
-                    if (loop != loop2 && un[loop2].number_living) {
-                        if (((un[loop2].alignment) & 1) != local_alignment) {
-                            n_int tx = un[loop2].average[0];
-                            n_int ty = un[loop2].average[1];
-                            n_uint dist_squ = (n_uint)((tx - px) * (tx - px) + (ty - py) * (ty - py));
-
-                            if (dist_squ < min_dist_squ) {
-                                min_dist_squ = dist_squ;
-                                un_att = &un[loop2];
-                            }
-                        }
-                    }
-                    loop2++;
-                }
+                un_att = battle_nearest_enemy(battle, loop, slack);
             }
             un[loop].unit_attacking = (void *)un_att;
         } else {
@@ -566,10 +1655,96 @@ n_byte battle_opponent(n_unit *un, n_uint num, n_uint *no_movement) {
     }
 
     if ((unit_movement[0] == 0) && (unit_movement[1] == 0)) {
-        (*no_movement)++;
+        battle->no_movement++;
     } else {
-        *no_movement = 0;
+        battle->no_movement = 0;
     }
 
     return ((unit_count[0] == 0) | (unit_count[1] == 0));
 }
+
+/**
+ * Returns the cycles before a unit and the unit it attacks could come within
+ * melee or missile reach. Combatants move no further than their type's
+ * maximum speed along each axis in a cycle, and finding a free cell adds at
+ * most one more, so the gap between the two areas along either axis closes
+ * by no more than both of those together.
+ */
+static n_int battle_contact_cycles(n_general_variables *gvar, n_unit *un, n_unit *un_at) {
+    n_type *typ = un->unit_type;
+    n_type *typ_at = un_at->unit_type;
+    n_int gap_x = battle_span_gap(un->area.top_left.x, un->area.bottom_right.x, un_at->area.top_left.x, un_at->area.bottom_right.x);
+    n_int gap_y = battle_span_gap(un->area.top_left.y, un->area.bottom_right.y, un_at->area.top_left.y, un_at->area.bottom_right.y);
+    n_int gap = (gap_x > gap_y) ? gap_x : gap_y;
+    n_int closing = typ->speed_maximum + typ_at->speed_maximum + 2;
+    n_int reach_squ = gvar->attack_melee_dsq;
+    n_int reach;
+
+    if ((un->missile_number != 0) && ((typ->missile_range * typ->missile_range) > reach_squ)) {
+        reach_squ = typ->missile_range * typ->missile_range;
+    }
+    reach = (n_int)math_root((n_uint)reach_squ);
+    if ((reach * reach) < reach_squ) {
+        reach++;
+    }
+    if (gap <= reach) {
+        return 0;
+    }
+    return (gap - reach) / closing;
+}
+
+/**
+ * Moves a battle on by up to most cycles at once while no unit can come
+ * within reach of the unit it attacks, returning the cycles passed over.
+ * Nothing else is run for those cycles: each moving combatant goes its
+ * speed for all of them in one step, toward its target or along its facing,
+ * and the missile timers count on. The random stream is not drawn from, so
+ * a battle that skips cycles differs from one stepped through them.
+ */
+n_uint battle_fast_forward(n_battle *battle, n_uint most) {
+    n_unit *units = battle->units;
+    n_int cycles = (n_int)most;
+    n_byte movement = 0;
+    n_uint loop = 0;
+
+    while (loop < battle->number_units) {
+        n_unit *un = &units[loop];
+        if (un->number_living > 0) {
+            n_unit *un_at = un->unit_attacking;
+            movement |= (un->moving != 0);
+            if ((un_at != NOTHING) && (un_at->number_living > 0)) {
+                n_int contact = battle_contact_cycles(&battle->game_vars, un, un_at);
+                if (contact < cycles) {
+                    cycles = contact;
+                }
+            }
+        }
+        loop++;
+    }
+
+    if ((movement == 0) || (cycles < BATTLE_FAST_FORWARD_MINIMUM)) {
+        return 0;
+    }
+
+    loop = 0;
+    while (loop < battle->number_units) {
+        n_unit *un = &units[loop];
+        if (un->number_living > 0) {
+            n_index loop2 = 0;
+            while (loop2 < un->living_count) {
+                combatant_move(battle, un, un->living[loop2++], cycles);
+            }
+            if (un->unit_attacking != NOTHING) {
+                n_int count = 0;
+                while (count < cycles) {
+                    (void)battle_missile_range(un);
+                    count++;
+                }
+            }
+            un->average[0] = (n_byte2)(un->location_sum.x / un->living_count);
+            un->average[1] = (n_byte2)(un->location_sum.y / un->living_count);
+        }
+        loop++;
+    }
+    return (n_uint)cycles;
+}
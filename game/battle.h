@@ -48,7 +48,52 @@
 
 #define BATTLE_BOARD_SIZE               (BATTLE_BOARD_WIDTH*BATTLE_BOARD_HEIGHT)
 
+/* the board holds one bit per cell in 32 bit words, an occupied plane then a side plane,
+   each with a guard word of columns either side and a guard row above and below */
+#define BATTLE_BOARD_GUARD_BITS         (32)
+#define BATTLE_BOARD_ROW_WORDS          ((BATTLE_BOARD_WIDTH >> 5) + 2)
+#define BATTLE_BOARD_WORDS              (BATTLE_BOARD_ROW_WORDS*(BATTLE_BOARD_HEIGHT + 2))
+#define BATTLE_BOARD_BYTES              (BATTLE_BOARD_WORDS*2*sizeof(n_byte4))
+
+/* Combatant indices and squared distances are 16 bit by default, so a unit
+   holds at most 65535 combatants. Building with BATTLE_INDEX_BITS of 32
+   widens both, and the move claims with them. */
+#ifndef BATTLE_INDEX_BITS
+#define BATTLE_INDEX_BITS               (16)
+#endif
+
+#if (BATTLE_INDEX_BITS == 32)
+typedef n_byte4 n_index;
+typedef n_byte4 n_distance;
+typedef n_byte8 n_claim;
+#define NUNIT_NO_ATTACK                 0xffffffff
+#define BATTLE_DISTANCE_MAX             0xffffffff
+#elif (BATTLE_INDEX_BITS == 16)
+typedef n_byte2 n_index;
+typedef n_byte2 n_distance;
+typedef n_byte4 n_claim;
 #define NUNIT_NO_ATTACK                 0xffff
+#define BATTLE_DISTANCE_MAX             0xffff
+#else
+#error "BATTLE_INDEX_BITS is 16 or 32"
+#endif
+
+/* a squared distance held as an n_distance, saturating rather than wrapping */
+#define BATTLE_DISTANCE(value)          ((n_distance)(((value) < BATTLE_DISTANCE_MAX) ? (value) : BATTLE_DISTANCE_MAX))
+
+#define BATTLE_MOVE_NONE                0xffffffff
+
+/* the distance any unit's average may move before a new snapshot of the averages is taken */
+#define BATTLE_RANKING_SLACK            (16)
+
+/* the fewest cycles worth passing over at once in a fast forward */
+#define BATTLE_FAST_FORWARD_MINIMUM     (4)
+
+#define BATTLE_GRID_SHIFT               (4)
+#define BATTLE_GRID_CELL                (1 << BATTLE_GRID_SHIFT)
+#define BATTLE_GRID_WIDTH               (BATTLE_BOARD_WIDTH >> BATTLE_GRID_SHIFT)
+#define BATTLE_GRID_HEIGHT              (BATTLE_BOARD_HEIGHT >> BATTLE_GRID_SHIFT)
+#define BATTLE_GRID_SIZE                (BATTLE_GRID_WIDTH*BATTLE_GRID_HEIGHT)
 
 #define NUNIT_DEAD			            (255)
 
@@ -57,8 +102,8 @@ typedef struct n_combatant
 {
     n_vect2 location;
     
-	n_byte2 attacking;
-	n_byte2 distance_squ;
+	n_index attacking;
+	n_distance distance_squ;
     
     n_byte speed_current;
 	n_byte direction_facing;
@@ -67,6 +112,96 @@ typedef struct n_combatant
 }
 n_combatant;
 
+/* Combatants are held as a structure of arrays per unit, one array for
+   each field, so a phase only loads the fields it reads. Defining
+   COMBATANT_AOS keeps the n_combatant array instead, and defining
+   COMBATANT_COMPACT an array of n_combatant_compact. */
+
+#if !defined(COMBATANT_AOS) && !defined(COMBATANT_COMPACT)
+#define COMBATANT_SOA
+#endif
+
+typedef struct n_combatant_array
+{
+    n_byte2 *x;
+    n_byte2 *y;
+
+    n_index *attacking;
+    n_distance *distance_squ;
+
+    n_byte  *speed_current;
+    n_byte  *direction_facing;
+    n_byte  *wounds;
+    n_byte  *combatant_state;
+}
+n_combatant_array;
+
+/* A combatant in 12 bytes rather than the 24 of n_combatant, or 16 rather
+   than 32 with 32 bit indices. The location is kept as 16 bit board cells,
+   as the board is far smaller than 65536 cells on a side. COMBATANT_LOCATION
+   and COMBATANT_SET_LOCATION convert to and from an n_vect2. */
+typedef struct n_combatant_compact
+{
+    n_byte2 x;
+    n_byte2 y;
+
+    n_index attacking;
+    n_distance distance_squ;
+
+    n_byte  speed_current;
+    n_byte  direction_facing;
+    n_byte  wounds;
+    n_byte  combatant_state;
+}
+n_combatant_compact;
+
+/* The accessors take a unit's combatants pointer and a combatant index */
+
+#ifdef COMBATANT_SOA
+
+#define COMBATANT_ARRAY(comb)           ((n_combatant_array *)(comb))
+
+#define COMBATANT_X(comb, num)          (COMBATANT_ARRAY(comb)->x[num])
+#define COMBATANT_Y(comb, num)          (COMBATANT_ARRAY(comb)->y[num])
+#define COMBATANT_ATTACKING(comb, num)  (COMBATANT_ARRAY(comb)->attacking[num])
+#define COMBATANT_DISTANCE(comb, num)   (COMBATANT_ARRAY(comb)->distance_squ[num])
+#define COMBATANT_SPEED(comb, num)      (COMBATANT_ARRAY(comb)->speed_current[num])
+#define COMBATANT_FACING(comb, num)     (COMBATANT_ARRAY(comb)->direction_facing[num])
+#define COMBATANT_WOUNDS(comb, num)     (COMBATANT_ARRAY(comb)->wounds[num])
+#define COMBATANT_STATE(comb, num)      (COMBATANT_ARRAY(comb)->combatant_state[num])
+
+#elif defined(COMBATANT_COMPACT)
+
+#define COMBATANT_RECORD(comb, num)     (((n_combatant_compact *)(comb))[num])
+
+#define COMBATANT_X(comb, num)          (COMBATANT_RECORD(comb, num).x)
+#define COMBATANT_Y(comb, num)          (COMBATANT_RECORD(comb, num).y)
+#define COMBATANT_ATTACKING(comb, num)  (COMBATANT_RECORD(comb, num).attacking)
+#define COMBATANT_DISTANCE(comb, num)   (COMBATANT_RECORD(comb, num).distance_squ)
+#define COMBATANT_SPEED(comb, num)      (COMBATANT_RECORD(comb, num).speed_current)
+#define COMBATANT_FACING(comb, num)     (COMBATANT_RECORD(comb, num).direction_facing)
+#define COMBATANT_WOUNDS(comb, num)     (COMBATANT_RECORD(comb, num).wounds)
+#define COMBATANT_STATE(comb, num)      (COMBATANT_RECORD(comb, num).combatant_state)
+
+#else
+
+#define COMBATANT_RECORD(comb, num)     (((n_combatant *)(comb))[num])
+
+#define COMBATANT_X(comb, num)          (COMBATANT_RECORD(comb, num).location.x)
+#define COMBATANT_Y(comb, num)          (COMBATANT_RECORD(comb, num).location.y)
+#define COMBATANT_ATTACKING(comb, num)  (COMBATANT_RECORD(comb, num).attacking)
+#define COMBATANT_DISTANCE(comb, num)   (COMBATANT_RECORD(comb, num).distance_squ)
+#define COMBATANT_SPEED(comb, num)      (COMBATANT_RECORD(comb, num).speed_current)
+#define COMBATANT_FACING(comb, num)     (COMBATANT_RECORD(comb, num).direction_facing)
+#define COMBATANT_WOUNDS(comb, num)     (COMBATANT_RECORD(comb, num).wounds)
+#define COMBATANT_STATE(comb, num)      (COMBATANT_RECORD(comb, num).combatant_state)
+
+#endif
+
+#define COMBATANT_LOCATION(comb, num, vect) vect2_populate((vect), COMBATANT_X(comb, num), COMBATANT_Y(comb, num))
+#define COMBATANT_SET_LOCATION(comb, num, vect) \
+    { COMBATANT_X(comb, num) = (n_byte2)(vect)->x; COMBATANT_Y(comb, num) = (n_byte2)(vect)->y; }
+
 #define	GET_TYPE(un)		  ((n_type *)((un)->unit_type))
 
 #define	UNIT_SIZE(un)		  ((GET_TYPE(un)->stature) >> 1)
@@ -103,6 +238,43 @@ typedef struct n_type {
     n_formation formation; // Add formation type
 } n_type;
 
+/* The slots of a formation, shared by the units with the same formation,
+   stature, angle and width. Each slot is offset from the unit's edge, which
+   is found from the unit's average, so placing a combatant or finding where
+   it belongs is a lookup. Templates are keyed on a unit's exact angle rather
+   than a bucket of angles, which is only safe as a unit's angle is fixed
+   when the scenario loads. */
+typedef struct n_template {
+    n_formation formation;
+    n_byte   stature;
+    n_byte   angle;
+    n_index  width;
+    n_index  slots;         /* entries in offsets, the most combatants of a unit using it */
+    n_vect2  facing;
+    n_int    across;        /* spacing of the slots along a line */
+    n_int    down;          /* spacing of the lines */
+    n_vect2 *offsets;
+} n_template;
+
+/* Per-tick bucketed index of a unit's living combatants. The cells are
+   BATTLE_GRID_CELL square, keyed off the board and limited to the unit's
+   area. Each cell lists its combatant indices in ascending order. */
+typedef struct n_grid {
+    n_byte2  left;
+    n_byte2  top;
+    n_byte2  width;
+    n_byte2  height;
+    n_index *start;
+    n_index *order;
+} n_grid;
+
+/* An enemy unit in a unit's ranking, with the squared distance between the
+   two averages in the snapshot the ranking was built from. */
+typedef struct n_rank {
+    n_byte4  distance_squ;
+    n_byte2  unit;
+} n_rank;
+
 // Add formation to the n_unit struct
 typedef struct n_unit {
     n_byte  morale;
@@ -111,13 +283,13 @@ typedef struct n_unit {
     n_byte2 average[2];
 
     n_byte2 width;
-    n_byte2 number_combatants;
+    n_index number_combatants;
 
     n_byte  alignment;
     n_byte  missile_number;
 
     n_byte  missile_timer;
-    n_byte2 number_living;
+    n_index number_living;
     
     n_area2 area;
     n_byte  selected;
@@ -126,30 +298,172 @@ typedef struct n_unit {
     void *combatants;
     void *unit_attacking;
     n_formation formation; // Add formation type
+
+    n_grid  grid;
+
+    n_index *living;        /* indices of the living combatants, ascending */
+    n_index living_count;   /* entries in living */
+
+    n_byte2 *columns;       /* living combatants in each board column, keeps the area */
+    n_byte2 *rows;          /* living combatants in each board row, keeps the area */
+    n_vect2  location_sum;  /* sum of the living combatants' locations, keeps the average */
+
+    n_index  moving;        /* living combatants with a speed */
+    n_byte   engagement;    /* n_engagement with the unit attacked this cycle */
+
+    n_rank  *ranking;       /* enemy units, nearest first in the snapshot */
+    n_byte2  ranking_count; /* entries in ranking */
+    n_byte2  ranking_epoch; /* snapshot the ranking was built from, zero for none */
+    n_byte2  ranked_average[2]; /* average in the current snapshot */
+
+    n_byte4 *moves;         /* cell each combatant proposes with MOVE_PROPOSE, BATTLE_MOVE_NONE for none */
+
+    n_template *formation_template; /* slots of the formation last filled, NOTHING before */
+    n_index *slots;         /* template slot of each combatant, moved with it by battle_sort */
 } n_unit;
 
+typedef enum {
+    DECLARE_LINEAR = 0,     /* scan every combatant of the target unit */
+    DECLARE_GRID_EXACT,     /* grid search, same targets as the linear scan */
+    DECLARE_GRID_NEAREST    /* grid search, first close enough found wins */
+} n_declare;
+
+typedef enum {
+    MOVE_SERIAL = 0,        /* each combatant moves in turn, seeing the moves before it */
+    MOVE_PROPOSE,           /* every combatant proposes a cell then the claims are committed */
+    MOVE_CONCURRENT         /* units move in parallel, claiming cells with compare and swap */
+} n_move;
+
 
 typedef struct n_general_variables {
     n_byte2 random0;
     n_byte2 random1;
-    n_byte2 attack_melee_dsq;
-    n_byte2 declare_group_facing_dsq;
-    n_byte2 declare_max_start_dsq;
-    n_byte2 declare_one_to_one_dsq;
-    n_byte2 declare_close_enough_dsq;
+    n_distance attack_melee_dsq;
+    n_distance declare_group_facing_dsq;
+    n_distance declare_max_start_dsq;
+    n_distance declare_one_to_one_dsq;
+    n_distance declare_close_enough_dsq;
+    n_byte2 declare_method;
+    n_byte2 move_method;
+    n_byte2 sort_interval;  /* cycles between putting each unit's combatants in Z-order, zero for never */
+    n_byte2 deterministic;  /* declare and attack rolls keyed by cycle, unit and combatant */
+    n_byte2 threads;        /* threads running the declare and attack phases */
+    n_byte4 random_key;     /* counter based random key for the cycle, when deterministic */
 }
 n_general_variables;
 
-typedef struct n_additional_variables{
+/* The purposes of the deterministic rolls, each split into its own key */
+typedef enum {
+    BATTLE_RANDOM_FACING = 1,
+    BATTLE_RANDOM_ATTACK
+} n_battle_random;
+
+/* How near a unit is to the unit it attacks, from the broad phase over the
+   units' areas. Only engaged units run every combatant through the kernels. */
+typedef enum {
+    BATTLE_FAR = 0,         /* no combatant is near enough the target's average to declare */
+    BATTLE_APPROACHING,     /* combatants declare, none are in melee or missile range */
+    BATTLE_ENGAGED
+} n_engagement;
+
+/* One unit type attacking another, built once per battle by battle_matchups.
+   The defence is lowered by the attacker's armour piercing. */
+typedef struct n_matchup {
     n_int probability_melee;
     n_int probability_missile;
     n_int damage_melee;
     n_int damage_missile;
+} n_matchup;
+
+typedef struct n_additional_variables{
+    n_matchup *matchup;
     n_int speed_max;
     n_int range_missile;
 } n_additional_variables;
 
-typedef void (*battle_function)(n_unit * un, n_general_variables * gvar);
+/* The parts of a cycle timed by the profiler, see engine_profile */
+typedef enum {
+    PROFILE_OPPONENT = 0,
+    PROFILE_SORT,
+    PROFILE_MOVE,
+    PROFILE_GRID,
+    PROFILE_DECLARE,
+    PROFILE_ATTACK,
+    PROFILE_REMOVE_DEAD,
+    PROFILE_FORMATION,
+    PROFILE_CYCLE,      /* the phases above added together */
+    PROFILE_DRAW,
+    PROFILE_PHASES
+} n_profile_phase;
+
+/* Samples kept of each phase for the percentiles */
+#define PROFILE_SAMPLES (16384)
+
+/* Times in nanoseconds from the monotonic clock. The percentiles cover the
+   latest PROFILE_SAMPLES of each phase, the count, total and maximum cover
+   every sample since profiling started. */
+typedef struct {
+    n_byte4  samples[PROFILE_PHASES][PROFILE_SAMPLES];
+    n_uint   count[PROFILE_PHASES];
+    n_uint   total[PROFILE_PHASES];
+    n_uint   maximum[PROFILE_PHASES];
+    n_uint   start;         /* of the phase running */
+    n_uint   cycle;         /* of the cycle so far */
+    n_profile_phase phase;  /* running */
+    n_byte   units;         /* time each unit as well */
+    n_uint  *unit_total;    /* unit_count by PROFILE_PHASES, or NOTHING */
+    n_uint   unit_count;
+} n_profile;
+
+/* Everything a battle holds. Battles share no state, so one process can
+   run many independent battles at once on separate threads. Conditions are
+   read with the toolkit's JSON parser, which is not re-entrant, so load
+   them on one thread at a time. A battle with threads above one runs its
+   phases through the process's one execute_group pool, so battles run side
+   by side each keep threads at one. */
+typedef struct n_battle {
+    n_unit  *units;
+    n_byte2  number_units;
+    n_type  *types;
+    n_byte2  number_types;
+    n_matchup *matchups;    /* number_types by number_types, attacker then defender */
+
+    n_byte8 *sort_keys;     /* the largest unit's worth of each, when sort_interval is set */
+    n_index *sort_remap;
+    n_index *sort_slots;
+    n_combatant *sort_combatants;
+
+    n_template *templates;  /* formation templates built so far */
+    n_uint   number_templates;
+    n_uint   templates_size;
+
+    n_general_variables game_vars;
+
+    n_byte4 *board;
+    n_claim *claims;        /* for each cell the strongest MOVE_PROPOSE claim, zero for none */
+
+    n_byte  *memory_buffer;
+    n_uint   memory_allocated;
+    n_uint   memory_used;
+
+    n_file  *open_file_json;
+
+    n_uint   no_movement;   /* cycles without any combatant moving */
+    n_byte2  ranking_epoch; /* snapshot of the unit averages, zero before the first */
+    n_int    count;         /* cycles run */
+    n_uint   skipped;       /* cycles passed over by engine_fast_forward */
+    n_byte   paused;
+    n_byte   new_required;
+    n_byte   debug;
+    n_byte   quiet;         /* no progress printing */
+
+    n_profile *profile;     /* NOTHING unless profiling */
+
+    void    *jobs;          /* used by battle_loop_execute */
+    n_uint   jobs_size;
+} n_battle;
+
+typedef void (*battle_function)(n_battle * battle, n_unit * un);
 typedef void (*combatant_function)(n_combatant * comb, n_general_variables * gvar, void * values);
 
 #define NUMBER_COMBATANTS_A     1024
@@ -170,60 +484,92 @@ typedef enum{
     BC_REGROUP
 }battle_command;
 
-n_byte board_clear(n_vect2 * pt);
+void   board_init(n_byte4 * board);
+n_byte board_clear(n_byte4 * board, n_vect2 * pt);
+n_byte board_occupied(n_byte4 * board, n_vect2 * pt);
+n_uint board_free_block(n_byte4 * board, n_vect2 * pt);
+n_byte board_find(n_byte4 * board, n_vect2 * pt);
+void   board_commit(n_byte4 * board, n_vect2 * fr, n_vect2 * pt);
+n_byte board_add_atomic(n_byte4 * board, n_vect2 * pt, n_byte side);
+n_byte board_move_atomic(n_byte4 * board, n_vect2 * fr, n_vect2 * pt);
 
-void * engine_init(n_uint random_init);
+void * engine_init(n_battle * battle, n_uint random_init);
 
 void engine_square_dimensions(n_vect2 * start, n_vect2 * end);
 
 
 unsigned char engine_mouse(short px, short py);
-void engine_mouse_up(void);
-void engine_key_received(n_byte2 key);
-
-n_int engine_update(void);
-n_int engine_new(void);
-n_byte engine_over(void);
-
-n_int engine_conditions(n_file *file_json);
-n_file * engine_conditions_file(n_constant_string file_name);
-
-n_unit * engine_units(n_byte2 * num_units);
-
-void engine_cycle(void);
-void engine_scorecard(void);
-void engine_exit(void);
-
-void battle_fill(n_unit * un, n_general_variables * gvar);
-void battle_move(n_unit *un, n_general_variables * gvar);
-void battle_declare(n_unit *un, n_general_variables * gvar);
-void battle_attack(n_unit *un, n_general_variables * gvar);
-void battle_remove_dead(n_unit *un, n_general_variables * gvar);
+void engine_mouse_up(n_battle * battle);
+void engine_key_received(n_battle * battle, n_byte2 key);
+
+n_int engine_update(n_battle * battle);
+n_int engine_new(n_battle * battle);
+n_int engine_start(n_battle * battle, n_file * file_json, n_uint random_init);
+n_byte engine_over(n_battle * battle);
+n_uint engine_fast_forward(n_battle * battle, n_uint most);
+
+n_int engine_conditions(n_battle * battle, n_file *file_json);
+n_file * engine_conditions_file(n_battle * battle, n_constant_string file_name);
+
+n_unit * engine_units(n_battle * battle, n_byte2 * num_units);
+
+void engine_cycle(n_battle * battle);
+void engine_scorecard(n_battle * battle);
+n_int engine_score(n_battle * battle, n_uint * count);
+void engine_exit(n_battle * battle);
+
+n_byte8 engine_digest_unit(n_battle * battle, n_unit * un);
+n_byte8 engine_digest(n_battle * battle);
+
+n_int engine_profile(n_battle * battle, n_byte enable, n_byte units);
+n_uint engine_profile_clock(void);
+void engine_profile_begin(n_battle * battle, n_profile_phase phase);
+void engine_profile_end(n_battle * battle);
+void engine_profile_unit(n_battle * battle, n_unit * un, n_uint start);
+n_int engine_profile_write(n_battle * battle, n_constant_string file_name);
+
+void battle_fill(n_battle * battle, n_unit * un);
+void battle_move(n_battle * battle, n_unit * un);
+void battle_move_propose(n_battle * battle, n_unit * un);
+void battle_move_commit(n_battle * battle, n_unit * un);
+void battle_grid(n_battle * battle, n_unit * un);
+void battle_declare(n_battle * battle, n_unit * un);
+void battle_attack(n_battle * battle, n_unit * un);
+void battle_remove_dead(n_battle * battle, n_unit * un);
+void battle_sort(n_battle * battle, n_unit * un);
 
 void draw_init(void);
-void draw_cycle(n_unit *un, n_general_variables * gvar);
+void draw_cycle(n_battle * battle, n_unit * un);
 void draw_rectangle(n_int px1, n_int py1, n_int px2, n_int py2);
 void draw_render(n_byte * value);
 
-void draw_engine(n_byte * value);
+void draw_engine(n_battle * battle, n_byte * value);
 
 
 void draw_dpx(n_double dpx);
 void draw_dpy(n_double dpy);
 void draw_dpz(n_double dpz);
 
-void  combatant_loop(combatant_function func, n_unit * un, n_general_variables * gvar, void * values);
-void  battle_loop(battle_function func, n_unit * un, const n_uint count, n_general_variables * gvar);
-n_byte battle_opponent(n_unit * un, n_uint num, n_uint * no_movement);
+void * battle_combatants(n_battle * battle, n_index number);
+void  combatant_get(n_unit * un, n_index num, n_combatant * comb);
+void  combatant_set(n_unit * un, n_index num, n_combatant * comb);
 
-void board_init(n_byte * value);
+void  combatant_loop(combatant_function func, n_unit * un, n_general_variables * gvar, void * values);
+void  combatant_loop_living(combatant_function func, n_unit * un, n_general_variables * gvar, void * values);
+void  battle_living(n_unit * un);
+void  battle_loop(battle_function func, n_battle * battle, n_unit * un, const n_uint count);
+void  battle_loop_execute(battle_function func, n_battle * battle, n_unit * un, const n_uint count);
+n_byte battle_opponent(n_battle * battle);
+n_int battle_matchups(n_battle * battle);
+n_byte battle_formation_slot(n_unit * un, n_index num, n_vect2 * slot);
+n_uint battle_fast_forward(n_battle * battle, n_uint most);
 
-n_byte	board_add(n_vect2 * pt, n_byte color);
-n_byte	board_move(n_vect2 * fr, n_vect2 * pt);
+n_byte	board_add(n_byte4 * board, n_vect2 * pt, n_byte side);
+n_byte	board_move(n_byte4 * board, n_vect2 * fr, n_vect2 * pt);
 
 
-void mem_init(n_byte start);
-n_byte * mem_use(n_uint size);
+void mem_init(n_battle * battle, n_byte start);
+n_byte * mem_use(n_battle * battle, n_uint size);
 
 
 
@@ -42,17 +42,46 @@
 
 #include "battle.h"
 
-static n_byte *board = NOTHING; // Pointer to the game board
+// Each battle has its own board, passed to every function here. The board is
+// two bit planes of BATTLE_BOARD_WORDS words each: the occupied plane, which
+// every search reads, followed by the side plane, which records the alignment
+// of each occupied cell and is only touched when a cell is filled or cleared.
+//
+// Each plane has a guard ring around the playing area, a word of columns
+// either side and a row above and below, which board_init marks occupied and
+// nothing clears. A search next to an edge reads the guard cells as taken, so
+// it never crosses the edge and needs no bounds checks or wrapping. Points
+// passed in must be on the board, board_add alone wraps its requested point
+// once for placements that start off the board.
 
-#define XY_BOARD(pt) board[(pt->x) | ((pt->y) * BATTLE_BOARD_WIDTH)] // Macro to access board coordinates
+#define BOARD_CELL(pt)   ((((pt)->x + BATTLE_BOARD_GUARD_BITS) >> 5) + (((pt)->y + 1) * BATTLE_BOARD_ROW_WORDS))
+#define BOARD_BIT(pt)    ((n_byte4)1 << ((pt)->x & 31)) // Bit within the word
+#define BOARD_SIDE(board) (&(board)[BATTLE_BOARD_WORDS]) // Side plane following the occupied plane
 
-// Initializes the board with the given value
-void board_init(n_byte *value) {
-    board = value;
+#define BOARD_CLAIM_ATTEMPTS (9) // Searches a claim makes before giving up, one per cell of the block
+
+// Offsets of the 3x3 block in search order, matching the bits of board_free_block
+static const n_int board_offset_x[9] = {-1, 0, 1, -1, 0, 1, -1, 0, 1};
+static const n_int board_offset_y[9] = {-1, -1, -1, 0, 0, 0, 1, 1, 1};
+
+// Marks the guard ring occupied, the board must already be erased
+void board_init(n_byte4 *board) {
+    n_int loop = 0;
+    while (loop < BATTLE_BOARD_ROW_WORDS) {
+        board[loop] = 0xffffffff;
+        board[BATTLE_BOARD_WORDS - BATTLE_BOARD_ROW_WORDS + loop] = 0xffffffff;
+        loop++;
+    }
+    loop = 1;
+    while (loop < (BATTLE_BOARD_HEIGHT + 1)) {
+        board[loop * BATTLE_BOARD_ROW_WORDS] = 0xffffffff;
+        board[((loop + 1) * BATTLE_BOARD_ROW_WORDS) - 1] = 0xffffffff;
+        loop++;
+    }
 }
 
 // Checks if a point is within the board boundaries
-static n_int board_location_check(n_vect2 *pt) {
+static n_int board_location_check(n_byte4 *board, n_vect2 *pt) {
     if (board == NOTHING) {
         return SHOW_ERROR("board not initialized");
     }
@@ -62,96 +91,224 @@ static n_int board_location_check(n_vect2 *pt) {
     return 0; // Success
 }
 
-// Fills a board location with a given number
-static void board_fill(n_vect2 *pt, n_byte number) {
-    if (board_location_check(pt) == -1) {
-        return; // Exit if the location is invalid
-    }
-    XY_BOARD(pt) = number;
+// Fills a board location for the given side
+static void board_fill(n_byte4 *board, n_vect2 *pt, n_byte side) {
+    n_int word = BOARD_CELL(pt);
+    n_byte4 bit = BOARD_BIT(pt);
+    board[word] |= bit;
+    BOARD_SIDE(board)[word] = (BOARD_SIDE(board)[word] & ~bit) | (side ? bit : 0);
 }
 
-// Clears a board location and returns its value
-n_byte board_clear(n_vect2 *pt) {
-    n_byte value;
-    if (board_location_check(pt) == -1) {
-        return 0; // Exit if the location is invalid
-    }
-    value = XY_BOARD(pt);
-    XY_BOARD(pt) = 0; // Clear the location
-    return value;
+// Clears a board location and returns the side that held it
+static n_byte board_take(n_byte4 *board, n_vect2 *pt) {
+    n_int word = BOARD_CELL(pt);
+    n_byte4 bit = BOARD_BIT(pt);
+    board[word] &= ~bit;
+    return (BOARD_SIDE(board)[word] & bit) != 0;
+}
+
+// Clears a board location, returns 1 if it was occupied
+n_byte board_clear(n_byte4 *board, n_vect2 *pt) {
+    n_byte occupied = (board[BOARD_CELL(pt)] & BOARD_BIT(pt)) != 0;
+    (void)board_take(board, pt);
+    return occupied;
 }
 
 // Checks if a board location is occupied
-static n_int board_occupied(n_vect2 *pt) {
-    if (board_location_check(pt) == -1) {
-        return 1; // Treat as occupied if the location is invalid
-    }
-    return (XY_BOARD(pt) > 127); // Returns 1 if occupied, 0 otherwise
+n_byte board_occupied(n_byte4 *board, n_vect2 *pt) {
+    return (board[BOARD_CELL(pt)] & BOARD_BIT(pt)) != 0; // Returns 1 if occupied, 0 otherwise
 }
 
-// Finds the nearest unoccupied location to the given point
-static n_byte board_find(n_vect2 *pt) {
-    n_uint best_dsqu = BIG_INTEGER; // Initialize with a large value
-    n_int best_x = 0, best_y = 0;
-    n_int ly = -1;
+// Returns the free cells of the 3x3 block centered on a point on the board,
+// bit (ly + 1) * 3 + (lx + 1) set for each free cell, guard cells never free
+n_uint board_free_block(n_byte4 *board, n_vect2 *pt) {
+    n_int start = pt->x + BATTLE_BOARD_GUARD_BITS - 1;
+    n_byte4 *row = &board[(start >> 5) + (pt->y * BATTLE_BOARD_ROW_WORDS)];
+    n_int shift = start & 31;
+    n_byte8 occupied;
 
-    // Wrap coordinates within board boundaries
-    pt->x = (pt->x + BATTLE_BOARD_WIDTH) % BATTLE_BOARD_WIDTH;
-    pt->y = (pt->y + BATTLE_BOARD_HEIGHT) % BATTLE_BOARD_HEIGHT;
+    // Each row is read as a pair of words so the three columns can span a word edge
+    occupied = ((row[0] | ((n_byte8)row[1] << 32)) >> shift) & 7;
+    row += BATTLE_BOARD_ROW_WORDS;
+    occupied |= (((row[0] | ((n_byte8)row[1] << 32)) >> shift) & 7) << 3;
+    row += BATTLE_BOARD_ROW_WORDS;
+    occupied |= (((row[0] | ((n_byte8)row[1] << 32)) >> shift) & 7) << 6;
+
+    return (n_uint)((~occupied) & 511);
+}
 
-    if (board_occupied(pt) == 0) {
+// Finds the nearest unoccupied location to the given point on the board,
+// only reading the board
+n_byte board_find(n_byte4 *board, n_vect2 *pt) {
+    n_uint best_dsqu = BIG_INTEGER; // Initialize with a large value
+    n_int best = 0;
+    n_uint free_cells;
+    n_int loop = 0;
+
+    if (board_occupied(board, pt) == 0) {
         return 1; // Location is already unoccupied
     }
 
+    free_cells = board_free_block(board, pt);
+    if (free_cells == 0) {
+        return 0; // The whole block is taken
+    }
+
     // Search neighboring locations
-    while (ly < 2) {
-        n_int lx = -1;
-        n_int y_val = (pt->y + ly + BATTLE_BOARD_HEIGHT) % BATTLE_BOARD_HEIGHT;
-        while (lx < 2) {
-            n_int x_val = (pt->x + lx + BATTLE_BOARD_WIDTH) % BATTLE_BOARD_WIDTH;
-            n_vect2 value = {x_val, y_val};
-
-            if (board_occupied(&value) == 0) {
-                n_int dx = (pt->x - lx);
-                n_int dy = (pt->y - ly);
-                n_uint dsqu = (dx * dx) + (dy * dy); // Calculate squared distance
-
-                if (dsqu < best_dsqu) {
-                    best_dsqu = dsqu;
-                    best_x = x_val;
-                    best_y = y_val;
-                }
+    while (loop < 9) {
+        if (free_cells & (1 << loop)) {
+            n_int dx = (pt->x - board_offset_x[loop]);
+            n_int dy = (pt->y - board_offset_y[loop]);
+            n_uint dsqu = (dx * dx) + (dy * dy); // Calculate squared distance
+
+            if (dsqu < best_dsqu) {
+                best_dsqu = dsqu;
+                best = loop;
             }
-            lx++;
         }
-        ly++;
+        loop++;
     }
 
-    if (best_dsqu != BIG_INTEGER) {
-        pt->x = best_x;
-        pt->y = best_y;
-        return 1; // Found a valid location
-    }
-    return 0; // No valid location found
+    pt->x += board_offset_x[best];
+    pt->y += board_offset_y[best];
+    return 1; // Found a valid location
 }
 
-// Adds a new element to the board at the nearest unoccupied location
-n_byte board_add(n_vect2 *pt, n_byte color) {
-    if (board_find(pt)) {
-        board_fill(pt, color);
+// Adds a new element for a side to the board at the nearest unoccupied location
+n_byte board_add(n_byte4 *board, n_vect2 *pt, n_byte side) {
+    // Wrap the requested point within board boundaries
+    pt->x = (pt->x + BATTLE_BOARD_WIDTH) % BATTLE_BOARD_WIDTH;
+    pt->y = (pt->y + BATTLE_BOARD_HEIGHT) % BATTLE_BOARD_HEIGHT;
+
+    if (board_location_check(board, pt) == -1) {
+        return 0; // Exit if the location is invalid
+    }
+    if (board_find(board, pt)) {
+        board_fill(board, pt, side);
         return 1; // Success
     }
     return 0; // Failed to find a location
 }
 
+// Moves an element to a location known to be free and claimed by it alone.
+// Other threads may commit moves between other cells at the same time, so
+// each word is changed atomically.
+void board_commit(n_byte4 *board, n_vect2 *fr, n_vect2 *pt) {
+    n_int from_word = BOARD_CELL(fr);
+    n_int to_word = BOARD_CELL(pt);
+    n_byte4 from_bit = BOARD_BIT(fr);
+    n_byte4 to_bit = BOARD_BIT(pt);
+#ifndef _WIN32
+    n_byte side = (__atomic_load_n(&BOARD_SIDE(board)[from_word], __ATOMIC_RELAXED) & from_bit) != 0;
+    (void)__atomic_fetch_and(&board[from_word], ~from_bit, __ATOMIC_RELAXED);
+    if (side) {
+        (void)__atomic_fetch_or(&BOARD_SIDE(board)[to_word], to_bit, __ATOMIC_RELAXED);
+    } else {
+        (void)__atomic_fetch_and(&BOARD_SIDE(board)[to_word], ~to_bit, __ATOMIC_RELAXED);
+    }
+    (void)__atomic_fetch_or(&board[to_word], to_bit, __ATOMIC_RELAXED);
+#else
+    // Windows runs the phases on one thread
+    n_byte side = board_take(board, fr);
+    board_fill(board, pt, side);
+#endif
+}
+
+// Claims a free cell for a side with a compare and swap of its word, returns
+// 0 if the cell was taken first
+static n_byte board_claim(n_byte4 *board, n_vect2 *pt, n_byte side) {
+    n_int word = BOARD_CELL(pt);
+    n_byte4 bit = BOARD_BIT(pt);
+#ifndef _WIN32
+    n_byte4 expected = __atomic_load_n(&board[word], __ATOMIC_RELAXED);
+    do {
+        if (expected & bit) {
+            return 0;
+        }
+    } while (__atomic_compare_exchange_n(&board[word], &expected, expected | bit, 1, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED) == 0);
+    if (side) {
+        (void)__atomic_fetch_or(&BOARD_SIDE(board)[word], bit, __ATOMIC_RELAXED);
+    } else {
+        (void)__atomic_fetch_and(&BOARD_SIDE(board)[word], ~bit, __ATOMIC_RELAXED);
+    }
+    return 1;
+#else
+    // Windows runs the phases on one thread
+    if (board[word] & bit) {
+        return 0;
+    }
+    board_fill(board, pt, side);
+    return 1;
+#endif
+}
+
+// Clears a cell held by the caller, leaving the rest of its word to other threads
+static void board_release(n_byte4 *board, n_vect2 *pt) {
+#ifndef _WIN32
+    (void)__atomic_fetch_and(&board[BOARD_CELL(pt)], ~BOARD_BIT(pt), __ATOMIC_RELEASE);
+#else
+    (void)board_take(board, pt);
+#endif
+}
+
+// Searches for the nearest free cell and claims it, searching again from the
+// requested point each time another thread takes the cell first
+static n_byte board_find_claim(n_byte4 *board, n_vect2 *pt, n_byte side) {
+    n_vect2 requested = *pt;
+    n_int attempt = 0;
+    while (attempt < BOARD_CLAIM_ATTEMPTS) {
+        if (board_find(board, pt) == 0) {
+            return 0;
+        }
+        if (board_claim(board, pt, side)) {
+            return 1;
+        }
+        *pt = requested;
+        attempt++;
+    }
+    return 0;
+}
+
+// Adds an element like board_add, safe alongside other threads adding and
+// moving elements of other units on the same board
+n_byte board_add_atomic(n_byte4 *board, n_vect2 *pt, n_byte side) {
+    pt->x = (pt->x + BATTLE_BOARD_WIDTH) % BATTLE_BOARD_WIDTH;
+    pt->y = (pt->y + BATTLE_BOARD_HEIGHT) % BATTLE_BOARD_HEIGHT;
+
+    if (board_location_check(board, pt) == -1) {
+        return 0;
+    }
+    return board_find_claim(board, pt, side);
+}
+
+// Moves an element like board_move, safe alongside other threads adding and
+// moving elements of other units on the same board. The destination is
+// claimed before the source is released, so the element is never off the board.
+n_byte board_move_atomic(n_byte4 *board, n_vect2 *fr, n_vect2 *pt) {
+    n_byte side;
+    if (board_location_check(board, pt) == -1) {
+        return 0;
+    }
+#ifndef _WIN32
+    side = (__atomic_load_n(&BOARD_SIDE(board)[BOARD_CELL(fr)], __ATOMIC_RELAXED) & BOARD_BIT(fr)) != 0;
+#else
+    side = (BOARD_SIDE(board)[BOARD_CELL(fr)] & BOARD_BIT(fr)) != 0;
+#endif
+    if (board_find_claim(board, pt, side)) {
+        board_release(board, fr);
+        return 1;
+    }
+    return 0;
+}
+
 // Moves an element from one location to another
-n_byte board_move(n_vect2 *fr, n_vect2 *pt) {
-    if (board_location_check(pt) == -1) {
+n_byte board_move(n_byte4 *board, n_vect2 *fr, n_vect2 *pt) {
+    if (board_location_check(board, pt) == -1) {
         return 0; // Exit if the destination is invalid
     }
-    if (board_find(pt)) {
-        n_byte color = board_clear(fr); // Clear the source location
-        board_fill(pt, color); // Fill the destination location
+    if (board_find(board, pt)) {
+        n_byte side = board_take(board, fr); // Clear the source location
+        board_fill(board, pt, side); // Fill the destination location
         return 1; // Success
     }
     return 0; // Failed to move
@@ -35,6 +35,11 @@
 
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#ifdef _WIN32
+#include <windows.h>
+#endif
 #include "toolkit.h"
 #include "battle.h"
 
@@ -204,72 +209,64 @@ const n_string_block json_file_string =
     "]"
     "}";
 
-// External variables
-extern n_unit *units;          // Array of units
-extern n_byte2 number_units;   // Number of units
-extern n_type *types;          // Array of unit types
-extern n_byte2 number_types;   // Number of unit types
-extern n_file *open_file_json; // JSON file handle
-
-// Global variables
-static n_uint no_movement = 0; // Counter for no movement
-static n_byte engine_paused = 0; // Pause state
-static n_byte engine_new_required = 0; // Flag to reset the game
-static n_byte engine_debug = 0; // Debug mode
-static n_int engine_count = 0; // Game cycle counter
-
-n_general_variables game_vars; // Game variables
-
 #define SIZEOF_MEMORY (64 * 1024 * 1024) // Memory buffer size
 
-static n_byte *memory_buffer; // Memory buffer
-static n_uint memory_allocated; // Allocated memory size
-static n_uint memory_used; // Used memory size
+#define ENGINE_PROFILE_FILE "profile.csv" // Written when the profiler key stops profiling
 
 // Function to initialize memory
-void mem_init(n_byte start) {
+void mem_init(n_battle *battle, n_byte start) {
     if (start) {
-        memory_buffer = NOTHING;
-        memory_allocated = SIZEOF_MEMORY;
-        memory_buffer = memory_new_range((SIZEOF_MEMORY / 4), &memory_allocated);
+        battle->memory_buffer = NOTHING;
+        battle->memory_allocated = SIZEOF_MEMORY;
+        battle->memory_buffer = memory_new_range((SIZEOF_MEMORY / 4), &battle->memory_allocated);
     }
-    memory_used = 0;
+    battle->memory_used = 0;
 }
 
 // Function to allocate memory
-n_byte *mem_use(n_uint size) {
+n_byte *mem_use(n_battle *battle, n_uint size) {
     n_byte *val = NOTHING;
-    if (size > (memory_allocated - memory_used)) {
-        engine_exit(); // Exit if out of memory
+    if (size > (battle->memory_allocated - battle->memory_used)) {
+        engine_exit(battle); // Exit if out of memory
     }
-    val = &memory_buffer[memory_used];
-    memory_used += size;
+    val = &battle->memory_buffer[battle->memory_used];
+    battle->memory_used += size;
     return val;
 }
 
-n_byte *local_board; // Local game board
-
 // Initialize the game engine
-void *engine_init(n_uint random_init) {
-    engine_count = 0;
+void *engine_init(n_battle *battle, n_uint random_init) {
+    n_general_variables *game_vars = &battle->game_vars;
+    n_byte quiet = battle->quiet;
+
+    // Start from nothing, keeping whether to print progress
+    memory_erase((n_byte *)battle, sizeof(n_battle));
+    battle->quiet = quiet;
 
     // Initialize random seeds
-    game_vars.random0 = (n_byte2)(random_init & 0xFFFF);
-    game_vars.random1 = (n_byte2)(random_init >> 16);
+    game_vars->random0 = (n_byte2)(random_init & 0xFFFF);
+    game_vars->random1 = (n_byte2)(random_init >> 16);
 
-    printf("random (%hu, %hu)\n", game_vars.random0, game_vars.random1);
+    if (battle->quiet == 0) {
+        printf("random (%hu, %hu)\n", game_vars->random0, game_vars->random1);
+    }
 
     // Set game variables
-    game_vars.attack_melee_dsq = 5;
-    game_vars.declare_group_facing_dsq = 8000;
-    game_vars.declare_max_start_dsq = 0xFFFF;
-    game_vars.declare_one_to_one_dsq = 0xFFFF;
-    game_vars.declare_close_enough_dsq = 5;
-
-    mem_init(1); // Initialize memory
-    engine_new(); // Start a new game
-
-    return (void *)local_board;
+    game_vars->attack_melee_dsq = 5;
+    game_vars->declare_group_facing_dsq = 8000;
+    game_vars->declare_max_start_dsq = 0xFFFF;
+    game_vars->declare_one_to_one_dsq = 0xFFFF;
+    game_vars->declare_close_enough_dsq = 5;
+    game_vars->declare_method = DECLARE_GRID_EXACT;
+    game_vars->move_method = MOVE_SERIAL;
+    game_vars->sort_interval = 0;
+    game_vars->deterministic = 0;
+    game_vars->threads = 1;
+
+    mem_init(battle, 1); // Initialize memory
+    engine_new(battle); // Start a new game
+
+    return (void *)battle->board;
 }
 
 // Static variables for mouse interaction
@@ -279,11 +276,11 @@ static n_int startx = -1, starty = -1, endx = -1, endy = -1;
 // Function to handle unit selection based on mouse input
 void engine_unit(n_unit *unit, n_int startx, n_int starty, n_int endx, n_int endy) {
     n_int loop = 0;
-    n_combatant *combatants = (n_combatant *)unit->combatants;
+    void *combatants = unit->combatants;
 
-    while (loop < unit->number_combatants) {
-        n_int px = combatants[loop].location.x;
-        n_int py = combatants[loop].location.y;
+    while (loop < unit->living_count) {
+        n_int px = COMBATANT_X(combatants, unit->living[loop]);
+        n_int py = COMBATANT_Y(combatants, unit->living[loop]);
 
         if ((startx <= px) && (px <= endx) && (starty <= py) && (py <= endy)) {
             unit->selected = 1;
@@ -295,7 +292,7 @@ void engine_unit(n_unit *unit, n_int startx, n_int starty, n_int endx, n_int end
 }
 
 // Function to handle mouse release event
-void engine_mouse_up(void) {
+void engine_mouse_up(n_battle *battle) {
     n_int loop = 0;
     printf("start (%ld, %ld) end (%ld, %ld)\n", startx, starty, endx, endy);
 
@@ -317,8 +314,8 @@ void engine_mouse_up(void) {
     endx = (endx << 10) / 800;
     endy = (endy << 10) / 800;
 
-    while (loop < number_units) {
-        engine_unit(&units[loop], startx, starty, endx, endy);
+    while (loop < battle->number_units) {
+        engine_unit(&battle->units[loop], startx, starty, endx, endy);
         loop++;
     }
 
@@ -354,102 +351,497 @@ void engine_square_dimensions(n_vect2 *start, n_vect2 *end) {
 
 
 // Function to start a new game
-n_int engine_new(void) {
-    no_movement = 0;
+n_int engine_new(n_battle *battle) {
+    battle->no_movement = 0;
+
+    if (battle->open_file_json == 0L) {
+        battle->open_file_json = io_file_new_from_string_block((n_string)json_file_string);
+    }
+    engine_conditions(battle, battle->open_file_json);
+    return 0;
+}
+
+// Function to start a battle from the conditions with a new random seed
+n_int engine_start(n_battle *battle, n_file *file_json, n_uint random_init) {
+    battle->no_movement = 0;
+    battle->count = 0;
+    battle->skipped = 0;
 
-    if (open_file_json == 0L) {
-        open_file_json = io_file_new_from_string_block((n_string)json_file_string);
+    if (engine_conditions(battle, file_json) != 0) {
+        return -1;
     }
-    engine_conditions(open_file_json);
+    // The seed replaces the random values in the conditions
+    battle->game_vars.random0 = (n_byte2)(random_init & 0xFFFF);
+    battle->game_vars.random1 = (n_byte2)(random_init >> 16);
     return 0;
 }
 
 // Function to handle key input
-void engine_key_received(n_byte2 key) {
+void engine_key_received(n_battle *battle, n_byte2 key) {
     if ((key == 'p') || (key == 'P')) {
-        engine_paused = !engine_paused; // Toggle pause
+        battle->paused = !battle->paused; // Toggle pause
     }
     if ((key == 'n') || (key == 'N')) {
-        engine_new_required = 1; // Request new game
+        battle->new_required = 1; // Request new game
     }
     if ((key == 'd') || (key == 'D')) {
-        engine_debug = !engine_debug; // Toggle debug mode
+        battle->debug = !battle->debug; // Toggle debug mode
+    }
+    if ((key == 't') || (key == 'T')) {
+        // Toggle the profiler, writing what it timed when it stops
+        if (battle->profile) {
+            if ((engine_profile_write(battle, ENGINE_PROFILE_FILE) == 0) && (battle->quiet == 0)) {
+                printf("%s written\n", ENGINE_PROFILE_FILE);
+            }
+            (void)engine_profile(battle, 0, 0);
+        } else {
+            (void)engine_profile(battle, 1, 1);
+        }
     }
 }
 
-// Function to display game scorecard
-void engine_scorecard(void) {
-    n_uint count[2] = {0};
+// Function to count the living combatants of each alignment and return the cycles run
+n_int engine_score(n_battle *battle, n_uint *count) {
     n_int loop = 0;
-    while (loop < number_units) {
-        count[units[loop].alignment] += units[loop].number_living;
+    count[0] = 0;
+    count[1] = 0;
+    while (loop < battle->number_units) {
+        count[battle->units[loop].alignment & 1] += battle->units[loop].number_living;
         loop++;
     }
+    return battle->count;
+}
+
+// Function to display game scorecard
+void engine_scorecard(n_battle *battle) {
+    n_uint count[2];
+    (void)engine_score(battle, count);
     printf("%ld, %ld\n", count[0], count[1]);
-    printf("random (%hu, %hu), %ld\n", game_vars.random0, game_vars.random1, engine_count);
+    printf("random (%hu, %hu), %ld\n", battle->game_vars.random0, battle->game_vars.random1, battle->count);
 }
 
 // Add a function to change formation
-void engine_change_formation(n_unit *un, n_formation new_formation) {
+void engine_change_formation(n_battle *battle, n_unit *un, n_formation new_formation) {
     if (un->formation != new_formation) {
         un->formation = new_formation;
         // Reinitialize the unit's position based on the new formation
-        battle_fill(un, &game_vars);
-        printf("Unit %d: Changing formation to %d\n", un->alignment, new_formation);
+        battle_fill(battle, un);
+        if (battle->quiet == 0) {
+            printf("Unit %d: Changing formation to %d\n", un->alignment, new_formation);
+        }
     }
 }
 
 // Example usage in engine_cycle
-void engine_cycle(void) {
-    battle_loop(&battle_move, units, number_units, &game_vars);
-    battle_loop(&battle_declare, units, number_units, &game_vars);
-    battle_loop(&battle_attack, units, number_units, &game_vars);
-    battle_loop(&battle_remove_dead, units, number_units, NOTHING);
+void engine_cycle(n_battle *battle) {
+    n_general_variables *game_vars = &battle->game_vars;
+    n_unit *units = battle->units;
+    n_byte2 number_units = battle->number_units;
+
+    // Rolls made deterministically are keyed by the random seed and the cycle
+    game_vars->random_key = math_random_key(((n_byte4)game_vars->random1 << 16) | game_vars->random0, (n_byte4)battle->count);
+
+    // Every sort_interval cycles the combatants are put back in Z-order of their locations
+    if ((game_vars->sort_interval != 0) && (battle->count != 0) && ((battle->count % game_vars->sort_interval) == 0)) {
+        engine_profile_begin(battle, PROFILE_SORT);
+        battle_loop(&battle_sort, battle, units, number_units);
+    }
+
+    engine_profile_begin(battle, PROFILE_MOVE);
+    if (game_vars->move_method == MOVE_PROPOSE) {
+        battle_loop_execute(&battle_move_propose, battle, units, number_units);
+        battle_loop_execute(&battle_move_commit, battle, units, number_units);
+    } else if (game_vars->move_method == MOVE_CONCURRENT) {
+        battle_loop_execute(&battle_move, battle, units, number_units);
+    } else {
+        battle_loop(&battle_move, battle, units, number_units);
+    }
+    engine_profile_begin(battle, PROFILE_GRID);
+    battle_loop(&battle_grid, battle, units, number_units);
+    engine_profile_begin(battle, PROFILE_DECLARE);
+    battle_loop_execute(&battle_declare, battle, units, number_units);
+    engine_profile_begin(battle, PROFILE_ATTACK);
+    battle_loop_execute(&battle_attack, battle, units, number_units);
+    engine_profile_begin(battle, PROFILE_REMOVE_DEAD);
+    battle_loop(&battle_remove_dead, battle, units, number_units);
+    engine_profile_begin(battle, PROFILE_FORMATION);
 
     // Example: Change formation if under attack
     for (n_uint i = 0; i < number_units; i++) {
         if (units[i].unit_attacking != NOTHING) {
-            engine_change_formation(&units[i], FORMATION_PHALANX); // Change to phalanx when under attack
+            engine_change_formation(battle, &units[i], FORMATION_PHALANX); // Change to phalanx when under attack
         }
     }
+    engine_profile_end(battle);
 
-    engine_count++;
+    battle->count++;
 }
 
 // Function to check if the game is over
-n_byte engine_over(void) {
-    n_byte result = battle_opponent(units, number_units, &no_movement);
+n_byte engine_over(n_battle *battle) {
+    n_byte result;
+
+    engine_profile_begin(battle, PROFILE_OPPONENT);
+    result = battle_opponent(battle);
+    engine_profile_end(battle);
 
-    if (engine_debug) {
-        engine_scorecard();
+    if (battle->debug) {
+        engine_scorecard(battle);
     }
-    if ((result != 0) || (no_movement > 6)) {
-        printf("result %d no movement %ld\n", result, no_movement);
+    if ((result != 0) || (battle->no_movement > 6)) {
+        if (battle->quiet == 0) {
+            printf("result %d no movement %ld\n", result, battle->no_movement);
+        }
         return 1;
     }
     return 0;
 }
 
 // Function to update the game state
-n_int engine_update(void) {
-    if (engine_new_required) {
-        engine_new();
-        engine_new_required = 0;
-    } else if (engine_paused == 0) {
-        if (engine_over()) {
-            printf("engine_over\n");
-            engine_scorecard();
+n_int engine_update(n_battle *battle) {
+    if (battle->new_required) {
+        engine_new(battle);
+        battle->new_required = 0;
+    } else if (battle->paused == 0) {
+        if (engine_over(battle)) {
+            if (battle->quiet == 0) {
+                printf("engine_over\n");
+                engine_scorecard(battle);
+            }
             return 1;
         }
-        engine_cycle();
+        engine_cycle(battle);
     }
     return 0;
 }
 
-// Function to clean up and exit the game
-void engine_exit(void) {
-    if (open_file_json) {
-        io_file_free(&open_file_json);
+// Opt in fast forward, passes over up to most cycles while no unit can reach
+// the unit it attacks, returns the cycles passed over
+n_uint engine_fast_forward(n_battle *battle, n_uint most) {
+    n_uint cycles;
+    if (battle->new_required || battle->paused) {
+        return 0;
+    }
+    cycles = battle_fast_forward(battle, most);
+    if (cycles != 0) {
+        battle->count += cycles;
+        battle->skipped += cycles;
+        battle->no_movement = 0;
+    }
+    return cycles;
+}
+
+// Function to clean up the battle
+void engine_exit(n_battle *battle) {
+    if (battle->open_file_json) {
+        io_file_free(&battle->open_file_json);
+    }
+    if (battle->jobs) {
+        memory_free(&battle->jobs);
+    }
+    battle->jobs_size = 0;
+    (void)engine_profile(battle, 0, 0);
+    memory_free((void **)&battle->memory_buffer);
+}
+
+#define ENGINE_DIGEST_MULTIPLY (0x9E3779B97F4A7C15ULL)
+
+// Mix a word into a digest, a multiply and shift per word rather than per byte
+static n_byte8 engine_digest_mix(n_byte8 digest, n_byte8 value) {
+    digest = (digest ^ value) * ENGINE_DIGEST_MULTIPLY;
+    return digest ^ (digest >> 32);
+}
+
+// Digest of a unit, its combatants' positions, wounds, targets, facing, speed
+// and state, whichever way they are stored, and the unit it attacks. Targets
+// and distances go in as 16 bit values, no target as 0xffff, with any higher
+// bits mixed in apart, so the digests are the same for either index width
+n_byte8 engine_digest_unit(n_battle *battle, n_unit *un) {
+    void *combatants = un->combatants;
+    n_byte8 digest = engine_digest_mix(0, un->number_combatants);
+    n_index loop = 0;
+
+    digest = engine_digest_mix(digest, un->unit_attacking ? (n_uint)((n_unit *)un->unit_attacking - battle->units) : 0xffff);
+    digest = engine_digest_mix(digest, ((n_uint)un->formation << 16) | un->number_living);
+    while (loop < un->number_combatants) {
+        n_byte8 attacking = COMBATANT_ATTACKING(combatants, loop);
+        n_byte8 distance = COMBATANT_DISTANCE(combatants, loop);
+        if (attacking == NUNIT_NO_ATTACK) {
+            attacking = 0xffff;
+        }
+        digest = engine_digest_mix(digest, (n_byte8)COMBATANT_X(combatants, loop) |
+                                   ((n_byte8)COMBATANT_Y(combatants, loop) << 16) |
+                                   ((attacking & 0xffff) << 32) |
+                                   ((n_byte8)COMBATANT_WOUNDS(combatants, loop) << 48) |
+                                   ((n_byte8)COMBATANT_FACING(combatants, loop) << 56));
+        digest = engine_digest_mix(digest, (n_byte8)COMBATANT_SPEED(combatants, loop) |
+                                   ((n_byte8)COMBATANT_STATE(combatants, loop) << 8) |
+                                   ((distance & 0xffff) << 16));
+        if ((attacking | distance) >> 16) {
+            digest = engine_digest_mix(digest, (attacking >> 16) | ((distance >> 16) << 32));
+        }
+        loop++;
+    }
+    return digest;
+}
+
+// Digest of the whole battle, the cycle, the random state and every unit,
+// the same for the same state on any build
+n_byte8 engine_digest(n_battle *battle) {
+    n_byte8 digest = engine_digest_mix(0, (n_byte8)battle->count);
+    n_byte2 loop = 0;
+
+    digest = engine_digest_mix(digest, ((n_uint)battle->game_vars.random1 << 16) | battle->game_vars.random0);
+    while (loop < battle->number_units) {
+        digest = engine_digest_mix(digest, engine_digest_unit(battle, &battle->units[loop]));
+        loop++;
+    }
+    return digest;
+}
+
+static const n_constant_string engine_profile_names[PROFILE_PHASES] = {
+    "opponent", "sort", "move", "grid", "declare", "attack", "remove_dead", "formation", "cycle", "draw"
+};
+
+// Start or stop profiling, with units each unit's share of the phases run
+// through battle_loop is timed too, stopping discards what was timed
+n_int engine_profile(n_battle *battle, n_byte enable, n_byte units) {
+    if (battle->profile) {
+        if (battle->profile->unit_total) {
+            memory_free((void **)&battle->profile->unit_total);
+        }
+        memory_free((void **)&battle->profile);
+    }
+    if (enable == 0) {
+        return 0;
+    }
+    battle->profile = (n_profile *)memory_new(sizeof(n_profile));
+    if (battle->profile == NOTHING) {
+        return SHOW_ERROR("Profile not allocated");
+    }
+    memory_erase((n_byte *)battle->profile, sizeof(n_profile));
+    battle->profile->units = units;
+    return 0;
+}
+
+// The monotonic clock in nanoseconds
+n_uint engine_profile_clock(void) {
+#ifdef _WIN32
+    LARGE_INTEGER counter, frequency;
+    QueryPerformanceCounter(&counter);
+    QueryPerformanceFrequency(&frequency);
+    return (n_uint)((counter.QuadPart * 1000000000.0) / frequency.QuadPart);
+#else
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return ((n_uint)now.tv_sec * 1000000000) + (n_uint)now.tv_nsec;
+#endif
+}
+
+// Add a sample of a phase
+static void engine_profile_sample(n_profile *profile, n_profile_phase phase, n_uint time) {
+    profile->samples[phase][profile->count[phase] % PROFILE_SAMPLES] = (time > 0xFFFFFFFF) ? 0xFFFFFFFF : (n_byte4)time;
+    profile->count[phase]++;
+    profile->total[phase] += time;
+    if (time > profile->maximum[phase]) {
+        profile->maximum[phase] = time;
+    }
+}
+
+// Make room for the unit times when a cycle starts, outside any worker threads
+static void engine_profile_units(n_battle *battle) {
+    n_profile *profile = battle->profile;
+    if ((profile->units == 0) || (profile->unit_count == battle->number_units)) {
+        return;
+    }
+    if (profile->unit_total) {
+        memory_free((void **)&profile->unit_total);
+    }
+    profile->unit_count = 0;
+    profile->unit_total = (n_uint *)memory_new(sizeof(n_uint) * PROFILE_PHASES * battle->number_units);
+    if (profile->unit_total == NOTHING) {
+        (void)SHOW_ERROR("Unit profile not allocated");
+        profile->units = 0;
+        return;
+    }
+    memory_erase((n_byte *)profile->unit_total, sizeof(n_uint) * PROFILE_PHASES * battle->number_units);
+    profile->unit_count = battle->number_units;
+}
+
+// End the phase running, if any, and start timing the phase given
+void engine_profile_begin(n_battle *battle, n_profile_phase phase) {
+    n_profile *profile = battle->profile;
+    if (profile == NOTHING) {
+        return;
+    }
+    engine_profile_end(battle);
+    if (phase == PROFILE_OPPONENT) {
+        profile->cycle = 0;
+        engine_profile_units(battle);
+    }
+    profile->phase = phase;
+    profile->start = engine_profile_clock();
+}
+
+// End the phase running, the formation phase ends the cycle
+void engine_profile_end(n_battle *battle) {
+    n_profile *profile = battle->profile;
+    n_uint time;
+    if ((profile == NOTHING) || (profile->start == 0)) {
+        return;
+    }
+    time = engine_profile_clock() - profile->start;
+    profile->start = 0;
+    engine_profile_sample(profile, profile->phase, time);
+    if (profile->phase == PROFILE_DRAW) {
+        return;
+    }
+    profile->cycle += time;
+    if (profile->phase == PROFILE_FORMATION) {
+        engine_profile_sample(profile, PROFILE_CYCLE, profile->cycle);
+        profile->cycle = 0;
+    }
+}
+
+// Add the time since start to a unit's share of the phase running, called by
+// battle_loop from whichever thread runs the unit
+void engine_profile_unit(n_battle *battle, n_unit *un, n_uint start) {
+    n_profile *profile = battle->profile;
+    n_uint index = (n_uint)(un - battle->units);
+    if (index < profile->unit_count) {
+        profile->unit_total[(index * PROFILE_PHASES) + profile->phase] += engine_profile_clock() - start;
+    }
+}
+
+static int engine_profile_compare(const void *a, const void *b) {
+    n_byte4 first = *(const n_byte4 *)a;
+    n_byte4 second = *(const n_byte4 *)b;
+    return (first > second) - (first < second);
+}
+
+// The 50th, 90th and 99th percentiles of a phase's samples, nearest rank
+static void engine_profile_percentiles(n_profile *profile, n_profile_phase phase, n_byte4 *sorted, n_uint *percentiles) {
+    static const n_uint ranks[3] = {50, 90, 99};
+    n_uint samples = (profile->count[phase] < PROFILE_SAMPLES) ? profile->count[phase] : PROFILE_SAMPLES;
+    n_uint loop = 0;
+
+    memory_copy((n_byte *)profile->samples[phase], (n_byte *)sorted, samples * sizeof(n_byte4));
+    qsort(sorted, samples, sizeof(n_byte4), &engine_profile_compare);
+    while (loop < 3) {
+        n_uint rank = ((ranks[loop] * samples) + 99) / 100;
+        percentiles[loop] = (rank == 0) ? 0 : sorted[rank - 1];
+        loop++;
+    }
+}
+
+// Write the profile as CSV, a row for each phase then a row for each unit and phase timed
+static void engine_profile_csv(n_battle *battle, n_file *file, n_byte4 *sorted) {
+    n_profile *profile = battle->profile;
+    n_string_block line;
+    n_uint percentiles[3];
+    n_int phase = 0;
+    n_uint unit = 0;
+
+    (void)io_write(file, "phase,unit,count,total_us,mean_ns,p50_ns,p90_ns,p99_ns,maximum_ns", 1);
+    while (phase < PROFILE_PHASES) {
+        n_uint count = profile->count[phase];
+        engine_profile_percentiles(profile, (n_profile_phase)phase, sorted, percentiles);
+        sprintf(line, "%s,,%lu,%lu,%lu,%lu,%lu,%lu,%lu", engine_profile_names[phase], count,
+                profile->total[phase] / 1000, count ? (profile->total[phase] / count) : 0,
+                percentiles[0], percentiles[1], percentiles[2], profile->maximum[phase]);
+        (void)io_write(file, line, 1);
+        phase++;
+    }
+    while (unit < profile->unit_count) {
+        phase = 0;
+        while (phase < PROFILE_PHASES) {
+            n_uint total = profile->unit_total[(unit * PROFILE_PHASES) + phase];
+            if (total != 0) {
+                sprintf(line, "%s,%lu,%lu,%lu,%lu,,,,", engine_profile_names[phase], unit,
+                        profile->count[phase], total / 1000, profile->count[phase] ? (total / profile->count[phase]) : 0);
+                (void)io_write(file, line, 1);
+            }
+            phase++;
+        }
+        unit++;
+    }
+}
+
+// The profile as a JSON object, the phases then the units
+static n_object *engine_profile_object(n_battle *battle, n_byte4 *sorted) {
+    n_profile *profile = battle->profile;
+    n_object *return_object = object_number(0L, "cycles", battle->count);
+    n_array *phases = NOTHING;
+    n_array *units = NOTHING;
+    n_uint percentiles[3];
+    n_int phase = 0;
+    n_uint unit = 0;
+
+    while (phase < PROFILE_PHASES) {
+        n_uint count = profile->count[phase];
+        n_object *phase_object = object_string(0L, "phase", (n_string)engine_profile_names[phase]);
+        engine_profile_percentiles(profile, (n_profile_phase)phase, sorted, percentiles);
+        object_number(phase_object, "count", (n_int)count);
+        object_number(phase_object, "total_us", (n_int)(profile->total[phase] / 1000));
+        object_number(phase_object, "mean_ns", (n_int)(count ? (profile->total[phase] / count) : 0));
+        object_number(phase_object, "p50_ns", (n_int)percentiles[0]);
+        object_number(phase_object, "p90_ns", (n_int)percentiles[1]);
+        object_number(phase_object, "p99_ns", (n_int)percentiles[2]);
+        object_number(phase_object, "maximum_ns", (n_int)profile->maximum[phase]);
+        array_add_empty(&phases, array_object(phase_object));
+        phase++;
+    }
+    object_array(return_object, "phases", phases);
+
+    while (unit < profile->unit_count) {
+        n_object *unit_object = object_number(0L, "unit", (n_int)unit);
+        object_number(unit_object, "alignment", battle->units[unit].alignment);
+        phase = 0;
+        while (phase < PROFILE_PHASES) {
+            n_uint total = profile->unit_total[(unit * PROFILE_PHASES) + phase];
+            if (total != 0) {
+                object_number(unit_object, (n_string)engine_profile_names[phase], (n_int)(total / 1000));
+            }
+            phase++;
+        }
+        array_add_empty(&units, array_object(unit_object));
+        unit++;
+    }
+    if (units) {
+        object_array(return_object, "units_us", units);
+    }
+    return return_object;
+}
+
+// Write the profile to a file, JSON when the name ends in .json and CSV otherwise
+n_int engine_profile_write(n_battle *battle, n_constant_string file_name) {
+    n_int length = io_length((n_string)file_name, STRING_BLOCK_SIZE);
+    n_byte4 *sorted;
+    n_file *file;
+    n_int result;
+
+    if (battle->profile == NOTHING) {
+        return SHOW_ERROR("Nothing profiled");
+    }
+    sorted = (n_byte4 *)memory_new(sizeof(n_byte4) * PROFILE_SAMPLES);
+    if (sorted == NOTHING) {
+        return SHOW_ERROR("Profile samples not allocated");
+    }
+    if ((length >= 5) && (io_find((n_string)file_name, (length - 5), length, ".json", 5) != -1)) {
+        n_object *profile_object = engine_profile_object(battle, sorted);
+        file = unknown_json(profile_object, OBJECT_OBJECT);
+        obj_free(&profile_object);
+    } else {
+        file = io_file_new();
+        if (file) {
+            engine_profile_csv(battle, file, sorted);
+        }
+    }
+    memory_free((void **)&sorted);
+    if (file == NOTHING) {
+        return SHOW_ERROR("Profile not written");
     }
-    memory_free((void **)&memory_buffer);
+    result = io_disk_write(file, file_name);
+    io_file_free(&file);
+    return result;
 }
@@ -42,19 +42,6 @@
 #define BATTLE_JSON_LOCATION2 "battle.json"
 #define BATTLE_JSON_LOCATION3 "./war/game/battle.json"
 
-extern n_general_variables game_vars;
-extern n_unit *units;
-extern n_byte2 number_units;
-extern n_type *types;
-extern n_byte2 number_types;
-extern n_byte *local_board;
-
-static n_byte engine_paused = 0;
-static n_byte engine_new_required = 0;
-static n_byte engine_debug = 0;
-n_file *open_file_json = 0L;
-static n_int engine_count = 0;
-
 static n_object *obj_unit_type(n_type *values) {
     n_object *return_object = object_number(0L, "defence", values->defence);
     object_number(return_object, "melee_attack", values->melee_attack);
@@ -95,16 +82,11 @@ static n_object *obj_general_variables(n_general_variables *values) {
     object_number(return_object, "declare_max_start_dsq", values->declare_max_start_dsq);
     object_number(return_object, "declare_one_to_one_dsq", values->declare_one_to_one_dsq);
     object_number(return_object, "declare_close_enough_dsq", values->declare_close_enough_dsq);
-    return return_object;
-}
-
-static n_object *obj_additional_variables(n_additional_variables *values) {
-    n_object *return_object = object_number(0L, "probability_melee", values->probability_melee);
-    object_number(return_object, "probability_missile", values->probability_missile);
-    object_number(return_object, "damage_melee", values->damage_melee);
-    object_number(return_object, "damage_missile", values->damage_missile);
-    object_number(return_object, "speed_max", values->speed_max);
-    object_number(return_object, "range_missile", values->range_missile);
+    object_number(return_object, "declare_method", values->declare_method);
+    object_number(return_object, "move_method", values->move_method);
+    object_number(return_object, "sort_interval", values->sort_interval);
+    object_number(return_object, "deterministic", values->deterministic);
+    object_number(return_object, "threads", values->threads);
     return return_object;
 }
 
@@ -120,40 +102,41 @@ n_int draw_error(n_constant_string error_text, n_constant_string location, n_int
     return -1;
 }
 
-n_unit *engine_units(n_byte2 *num_units) {
-    *num_units = number_units;
-    return units;
+n_unit *engine_units(n_battle *battle, n_byte2 *num_units) {
+    *num_units = battle->number_units;
+    return battle->units;
 }
 
-n_file *engine_conditions_file(n_constant_string file_name) {
+n_file *engine_conditions_file(n_battle *battle, n_constant_string file_name) {
     n_file *file_json = io_file_new();
     if (io_disk_read_no_error(file_json, (n_string)file_name) != 0) {
         io_file_free(&file_json);
         return 0L;
-    } else {
+    } else if (battle->quiet == 0) {
         printf("%s loaded\n", file_name);
     }
-    if (open_file_json) {
-        io_file_free(&open_file_json);
+    if (battle->open_file_json) {
+        io_file_free(&battle->open_file_json);
     }
-    open_file_json = io_file_duplicate(file_json);
+    battle->open_file_json = io_file_duplicate(file_json);
     return file_json;
 }
 
 // Update engine_conditions to transfer formation from type to unit
-n_int engine_conditions(n_file *file_json) {
+n_int engine_conditions(n_battle *battle, n_file *file_json) {
     if (file_json == 0L) {
         return SHOW_ERROR("Read file failed");
     }
-    number_units = 0;
-    number_types = 0;
-    mem_init(0);
-    local_board = (n_byte *)mem_use(BATTLE_BOARD_SIZE);
-    if (local_board == NOTHING) {
+    battle->number_units = 0;
+    battle->number_types = 0;
+    battle->ranking_epoch = 0;
+    mem_init(battle, 0);
+    battle->board = (n_byte4 *)mem_use(battle, BATTLE_BOARD_BYTES);
+    if (battle->board == NOTHING) {
         return SHOW_ERROR("Local board not allocated");
     }
-    memory_erase(local_board, BATTLE_BOARD_SIZE);
-    board_init(local_board);
+    memory_erase((n_byte *)battle->board, BATTLE_BOARD_BYTES);
+    board_init(battle->board);
     io_whitespace_json(file_json);
     {
         n_object_type type_of;
@@ -171,10 +154,12 @@ n_int engine_conditions(n_file *file_json) {
                 n_array *arr_unit_types = obj_get_array(str_unit_types);
                 n_array *arr_follow = 0L;
                 n_int value;
-                types = (n_type *)mem_use(0);
+                battle->types = (n_type *)mem_use(battle, 0);
                 while ((arr_follow = obj_array_next(arr_unit_types, arr_follow))) {
                     n_object *obj_follow = obj_get_object(arr_follow->data);
-                    n_type *current_type = &types[number_types];
+                    n_type *current_type = &battle->types[battle->number_types];
+                    memory_erase((n_byte *)current_type, sizeof(n_type));
+                    current_type->formation = FORMATION_RECTANGLE;
                     if (obj_contains_number(obj_follow, "defence", &value)) {
                         current_type->defence = value;
                     }
@@ -187,6 +172,15 @@ n_int engine_conditions(n_file *file_json) {
                     if (obj_contains_number(obj_follow, "melee_armpie", &value)) {
                         current_type->melee_armpie = value;
                     }
+                    if (obj_contains_number(obj_follow, "missile_attack", &value)) {
+                        current_type->missile_attack = value;
+                    }
+                    if (obj_contains_number(obj_follow, "missile_damage", &value)) {
+                        current_type->missile_damage = value;
+                    }
+                    if (obj_contains_number(obj_follow, "missile_armpie", &value)) {
+                        current_type->missile_armpie = value;
+                    }
                     if (obj_contains_number(obj_follow, "missile_rate", &value)) {
                         current_type->missile_rate = value;
                     }
@@ -211,17 +205,18 @@ n_int engine_conditions(n_file *file_json) {
                     if (obj_contains_number(obj_follow, "formation", &value)) {
                         current_type->formation = (n_formation)value;
                     }
-                    (void)mem_use(sizeof(n_type));
-                    number_types++;
+                    (void)mem_use(battle, sizeof(n_type));
+                    battle->number_types++;
                 }
                 if (str_units) {
                     n_array *arr_units = obj_get_array(str_units);
                     n_array *arr_follow = 0L;
                     n_int value;
-                    units = (n_unit *)mem_use(0);
+                    battle->units = (n_unit *)mem_use(battle, 0);
                     while ((arr_follow = obj_array_next(arr_units, arr_follow))) {
                         n_object *obj_follow = obj_get_object(arr_follow->data);
-                        n_unit *current_unit = &units[number_units];
+                        n_unit *current_unit = &battle->units[battle->number_units];
+                        memory_erase((n_byte *)current_unit, sizeof(n_unit));
                         if (obj_contains_number(obj_follow, "type_id", &value)) {
                             current_unit->morale = value;
                         }
@@ -232,6 +227,10 @@ n_int engine_conditions(n_file *file_json) {
                             current_unit->angle = value;
                         }
                         if (obj_contains_number(obj_follow, "number_combatants", &value)) {
+                            if (value > NUNIT_NO_ATTACK) {
+                                SHOW_ERROR("Unit combatants beyond BATTLE_INDEX_BITS");
+                                value = NUNIT_NO_ATTACK;
+                            }
                             current_unit->number_combatants = value;
                         }
                         if (obj_contains_number(obj_follow, "alignment", &value)) {
@@ -241,11 +240,11 @@ n_int engine_conditions(n_file *file_json) {
                             current_unit->missile_number = value;
                         }
                         (void)obj_contains_array_nbyte2(obj_follow, "average", current_unit->average, 2);
-                        (void)mem_use(sizeof(n_unit));
-                        number_units++;
+                        (void)mem_use(battle, sizeof(n_unit));
+                        battle->number_units++;
                     }
                     if (obj_general_variables) {
-                        n_general_variables *values = (n_general_variables *)&game_vars;
+                        n_general_variables *values = (n_general_variables *)&battle->game_vars;
                         n_int value;
                         if (obj_contains_number(obj_general_variables, "random0", &value)) {
                             values->random0 = value;
@@ -268,34 +267,69 @@ n_int engine_conditions(n_file *file_json) {
                         if (obj_contains_number(obj_general_variables, "declare_close_enough_dsq", &value)) {
                             values->declare_close_enough_dsq = value;
                         }
+                        if (obj_contains_number(obj_general_variables, "declare_method", &value)) {
+                            values->declare_method = value;
+                        }
+                        if (obj_contains_number(obj_general_variables, "move_method", &value)) {
+                            values->move_method = value;
+                        }
+                        if (obj_contains_number(obj_general_variables, "sort_interval", &value)) {
+                            values->sort_interval = value;
+                        }
+                        if (obj_contains_number(obj_general_variables, "deterministic", &value)) {
+                            values->deterministic = value;
+                        }
+                        if (obj_contains_number(obj_general_variables, "threads", &value)) {
+                            values->threads = value;
+                        }
                     }
                 }
             }
             unknown_free(&returned_blob, type_of);
         }
     }
-    if ((number_types == 0) || (number_units == 0) || (number_types > 255)) {
+    if ((battle->number_types == 0) || (battle->number_units == 0) || (battle->number_types > 255)) {
         SHOW_ERROR("Type/Unit Logic Failed");
     }
     {
+        n_unit *units = battle->units;
+        n_type *types = battle->types;
         n_byte resolve[256] = {0};
         n_uint check_alignment[2] = {0};
-        n_byte loop = 0;
-        while (loop < number_types) {
+        n_byte2 loop = 0;
+        while (loop < battle->number_types) {
             resolve[types[loop].points_per_combatant] = loop;
             loop++;
         }
         loop = 0;
-        while (loop < number_units) {
-            n_byte2 local_combatants = units[loop].number_combatants;
+        while (loop < battle->number_units) {
+            n_index local_combatants = units[loop].number_combatants;
             units[loop].unit_type = &types[resolve[units[loop].morale]];
             units[loop].formation = types[resolve[units[loop].morale]].formation; // Ensure formation is set
             
-            printf("Unit %d: Formation = %d\n", loop, units[loop].formation);
+            if (battle->quiet == 0) {
+                printf("Unit %d: Formation = %d\n", loop, units[loop].formation);
+            }
             
             units[loop].morale = 255;
             units[loop].number_living = local_combatants;
-            units[loop].combatants = (n_combatant *)mem_use(sizeof(n_combatant) * local_combatants);
+            units[loop].combatants = battle_combatants(battle, local_combatants);
+            units[loop].grid.width = 0;
+            units[loop].grid.start = (n_index *)mem_use(battle, sizeof(n_index) * (BATTLE_GRID_SIZE + 4));
+            units[loop].grid.order = (n_index *)mem_use(battle, sizeof(n_index) * ((local_combatants + 3) & ~3));
+            units[loop].living = (n_index *)mem_use(battle, sizeof(n_index) * ((local_combatants + 3) & ~3));
+            units[loop].living_count = 0;
+            units[loop].columns = (n_byte2 *)mem_use(battle, sizeof(n_byte2) * (BATTLE_BOARD_WIDTH + BATTLE_BOARD_HEIGHT));
+            units[loop].rows = &units[loop].columns[BATTLE_BOARD_WIDTH];
+            units[loop].ranking = (n_rank *)mem_use(battle, sizeof(n_rank) * battle->number_units);
+            units[loop].ranking_count = 0;
+            units[loop].ranking_epoch = 0;
+            units[loop].moves = NOTHING;
+            units[loop].formation_template = NOTHING;
+            units[loop].slots = (n_index *)mem_use(battle, sizeof(n_index) * ((local_combatants + 3) & ~3));
+            if (battle->game_vars.move_method == MOVE_PROPOSE) {
+                units[loop].moves = (n_byte4 *)mem_use(battle, sizeof(n_byte4) * ((local_combatants + 3) & ~3));
+            }
             check_alignment[(units[loop].alignment) & 1]++;
             loop++;
         }
@@ -303,6 +337,40 @@ n_int engine_conditions(n_file *file_json) {
             SHOW_ERROR("Alignment Logic Failed");
         }
     }
-    battle_loop(&battle_fill, units, number_units, NOTHING);
+    if (battle_matchups(battle) != 0) {
+        return -1;
+    }
+    battle->claims = NOTHING;
+    if (battle->game_vars.move_method == MOVE_PROPOSE) {
+        // The claims are compared and swapped, so they start on a whole claim
+        (void)mem_use(battle, (0 - battle->memory_used) & (sizeof(n_claim) - 1));
+        battle->claims = (n_claim *)mem_use(battle, sizeof(n_claim) * BATTLE_BOARD_SIZE);
+        memory_erase((n_byte *)battle->claims, sizeof(n_claim) * BATTLE_BOARD_SIZE);
+    }
+    battle->sort_keys = NOTHING;
+    battle->sort_remap = NOTHING;
+    battle->sort_slots = NOTHING;
+    battle->sort_combatants = NOTHING;
+    if (battle->game_vars.sort_interval != 0) {
+        n_uint largest = 0;
+        n_byte2 loop = 0;
+        while (loop < battle->number_units) {
+            if (battle->units[loop].number_combatants > largest) {
+                largest = battle->units[loop].number_combatants;
+            }
+            loop++;
+        }
+        // The keys are sorted as whole words, so they start on one
+        (void)mem_use(battle, (0 - battle->memory_used) & (sizeof(n_byte8) - 1));
+        battle->sort_keys = (n_byte8 *)mem_use(battle, sizeof(n_byte8) * largest);
+        battle->sort_combatants = (n_combatant *)mem_use(battle, sizeof(n_combatant) * largest);
+        battle->sort_remap = (n_index *)mem_use(battle, sizeof(n_index) * largest);
+        battle->sort_slots = (n_index *)mem_use(battle, sizeof(n_index) * largest);
+    }
+    // A unit takes a template for each formation it is filled in
+    battle->templates_size = (n_uint)battle->number_units * (FORMATION_PHALANX + 1);
+    battle->templates = (n_template *)mem_use(battle, sizeof(n_template) * battle->templates_size);
+    battle->number_templates = 0;
+    battle_loop(&battle_fill, battle, battle->units, battle->number_units);
     return 0;
 }
@@ -0,0 +1,331 @@
+/****************************************************************
+
+ test_board.c
+
+ =============================================================
+
+ Copyright 1996-2025 Tom Barbalet. All rights reserved.
+
+ Permission is hereby granted, free of charge, to any person
+ obtaining a copy of this software and associated documentation
+ files (the "Software"), to deal in the Software without
+ restriction, including without limitation the rights to use,
+ copy, modify, merge, publish, distribute, sublicense, and/or
+ sell copies of the Software, and to permit persons to whom the
+ Software is furnished to do so, subject to the following
+ conditions:
+
+ The above copyright notice and this permission notice shall be
+ included in all copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ OTHER DEALINGS IN THE SOFTWARE.
+
+ This software is a continuing work of Tom Barbalet, begun on
+ 13 June 1996. No apes or cats were harmed in the writing of
+ this software.
+ ****************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "toolkit.h"
+#include "battle.h"
+
+static n_byte4 test_board_memory[BATTLE_BOARD_WORDS * 2];
+
+#define STRESS_THREADS   (8)
+#define STRESS_GROUPS    (64)
+#define STRESS_ELEMENTS  (500)
+#define STRESS_REGION    (160)
+#define STRESS_ROUNDS    (20)
+
+/* the elements one thread adds and moves, like a unit's combatants */
+typedef struct
+{
+    n_vect2 elements[STRESS_ELEMENTS];
+    n_int   count;
+    n_byte2 random[2];
+} stress_group;
+
+static stress_group stress_groups[STRESS_GROUPS];
+
+n_int draw_error( n_constant_string error_text, n_constant_string location, n_int line_number )
+{
+    printf( "ERROR: %s @%s, %ld\n", error_text, location, line_number );
+    return -1;
+}
+
+static n_byte4 * board_new(void)
+{
+    memory_erase((n_byte *)test_board_memory, BATTLE_BOARD_BYTES);
+    board_init(test_board_memory);
+    return test_board_memory;
+}
+
+static n_int check_add(n_byte4 * board, n_int x, n_int y, n_int expect_x, n_int expect_y)
+{
+    n_vect2 pt = {x, y};
+    if (board_add(board, &pt, 0) == 0)
+    {
+        printf("add at (%ld, %ld) failed\n", x, y);
+        return -1;
+    }
+    if ((pt.x != expect_x) || (pt.y != expect_y))
+    {
+        printf("add at (%ld, %ld) expects (%ld, %ld), instead (%ld, %ld)\n", x, y, expect_x, expect_y, pt.x, pt.y);
+        return -1;
+    }
+    return 0;
+}
+
+static n_int check_full(n_byte4 * board, n_int x, n_int y)
+{
+    n_vect2 pt = {x, y};
+    if (board_add(board, &pt, 0))
+    {
+        printf("add at (%ld, %ld) should fail, instead (%ld, %ld)\n", x, y, pt.x, pt.y);
+        return -1;
+    }
+    return 0;
+}
+
+static n_int check_block(n_byte4 * board, n_int x, n_int y, n_uint expect)
+{
+    n_vect2 pt = {x, y};
+    n_uint result = board_free_block(board, &pt);
+    if (result != expect)
+    {
+        printf("free block at (%ld, %ld) expects %03lx, instead %03lx\n", x, y, expect, result);
+        return -1;
+    }
+    return 0;
+}
+
+/* placement away from the edges prefers the free neighbors furthest along the axes */
+static n_int board_test_interior(void)
+{
+    n_byte4 * board = board_new();
+    n_int result = 0;
+
+    result |= check_add(board, 5, 5, 5, 5);
+    result |= check_block(board, 5, 5, 0x1ef);
+    result |= check_add(board, 5, 5, 6, 6);
+    result |= check_add(board, 5, 5, 6, 5);
+    result |= check_add(board, 5, 5, 5, 6);
+    result |= check_add(board, 5, 5, 6, 4);
+
+    /* a word edge falls between columns 31 and 32 */
+    result |= check_add(board, 31, 40, 31, 40);
+    result |= check_add(board, 32, 40, 32, 40);
+    result |= check_block(board, 31, 40, 0x1cf);
+    result |= check_block(board, 32, 40, 0x1e7);
+    return result;
+}
+
+/* searches next to an edge read the guard ring as occupied and never wrap */
+static n_int board_test_edges(void)
+{
+    n_byte4 * board = board_new();
+    n_int result = 0;
+
+    result |= check_block(board, 0, 0, 0x1b0);
+    result |= check_block(board, BATTLE_BOARD_WIDTH - 1, BATTLE_BOARD_HEIGHT - 1, 0x01b);
+
+    result |= check_add(board, 0, 0, 0, 0);
+    result |= check_add(board, 0, 0, 1, 0);
+    result |= check_add(board, 0, 0, 0, 1);
+    result |= check_add(board, 0, 0, 1, 1);
+    result |= check_full(board, 0, 0);
+
+    result |= check_add(board, BATTLE_BOARD_WIDTH - 1, 10, BATTLE_BOARD_WIDTH - 1, 10);
+    result |= check_add(board, BATTLE_BOARD_WIDTH - 1, 10, BATTLE_BOARD_WIDTH - 1, 11);
+    result |= check_add(board, BATTLE_BOARD_WIDTH - 1, 10, BATTLE_BOARD_WIDTH - 1, 9);
+
+    result |= check_add(board, 100, BATTLE_BOARD_HEIGHT - 1, 100, BATTLE_BOARD_HEIGHT - 1);
+    result |= check_add(board, 100, BATTLE_BOARD_HEIGHT - 1, 101, BATTLE_BOARD_HEIGHT - 1);
+    return result;
+}
+
+/* a requested point off the board wraps once before the search */
+static n_int board_test_wrap(void)
+{
+    n_byte4 * board = board_new();
+    n_int result = 0;
+
+    result |= check_add(board, -3, 2, BATTLE_BOARD_WIDTH - 3, 2);
+    result |= check_add(board, 7, BATTLE_BOARD_HEIGHT + 2, 7, 2);
+    return result;
+}
+
+/* moves carry the cell across and leave the source free */
+static n_int board_test_move(void)
+{
+    n_byte4 * board = board_new();
+    n_vect2 from = {20, 20};
+    n_vect2 to = {21, 20};
+    n_int result = 0;
+
+    result |= check_add(board, 20, 20, 20, 20);
+    result |= check_add(board, 21, 20, 21, 20);
+
+    if (board_move(board, &from, &to) == 0)
+    {
+        printf("move should succeed\n");
+        return -1;
+    }
+    if ((to.x != 22) || (to.y != 21))
+    {
+        printf("move expects (22, 21), instead (%ld, %ld)\n", to.x, to.y);
+        result = -1;
+    }
+    if (board_occupied(board, &from) || (board_occupied(board, &to) == 0))
+    {
+        printf("move should free the source and fill the destination\n");
+        result = -1;
+    }
+    if ((board_clear(board, &to) == 0) || board_clear(board, &to))
+    {
+        printf("clear should report the occupied cell once\n");
+        result = -1;
+    }
+    return result;
+}
+
+static n_int stress_offset(stress_group * group, n_int range)
+{
+    return (n_int)(math_random(group->random) % ((range * 2) + 1)) - range;
+}
+
+static n_int stress_add(void * general_data, void * read_data, void * write_data)
+{
+    n_byte4 * board = (n_byte4 *)general_data;
+    stress_group * group = (stress_group *)read_data;
+    n_int loop = 0;
+    group->count = 0;
+    while (loop < STRESS_ELEMENTS)
+    {
+        n_vect2 pt;
+        pt.x = 100 + (math_random(group->random) % STRESS_REGION);
+        pt.y = 100 + (math_random(group->random) % STRESS_REGION);
+        if (board_add_atomic(board, &pt, (n_byte)(group->random[1] & 1)))
+        {
+            group->elements[group->count++] = pt;
+        }
+        loop++;
+    }
+    return 0;
+}
+
+static n_int stress_move(void * general_data, void * read_data, void * write_data)
+{
+    n_byte4 * board = (n_byte4 *)general_data;
+    stress_group * group = (stress_group *)read_data;
+    n_int loop = 0;
+    while (loop < group->count)
+    {
+        n_vect2 to;
+        to.x = group->elements[loop].x + stress_offset(group, 2);
+        to.y = group->elements[loop].y + stress_offset(group, 2);
+        if ((OUTSIDE_WIDTH(to.x) == 0) && (OUTSIDE_HEIGHT(to.y) == 0) &&
+            board_move_atomic(board, &group->elements[loop], &to))
+        {
+            group->elements[loop] = to;
+        }
+        loop++;
+    }
+    return 0;
+}
+
+/* the occupied cells are exactly the elements held */
+static n_int stress_check(n_byte4 * board, n_int round)
+{
+    n_int occupied = 0, elements = 0;
+    n_vect2 pt;
+    n_int loop = 0;
+
+    pt.y = 0;
+    while (pt.y < BATTLE_BOARD_HEIGHT)
+    {
+        pt.x = 0;
+        while (pt.x < BATTLE_BOARD_WIDTH)
+        {
+            occupied += board_occupied(board, &pt);
+            pt.x++;
+        }
+        pt.y++;
+    }
+    while (loop < STRESS_GROUPS)
+    {
+        n_int element = 0;
+        while (element < stress_groups[loop].count)
+        {
+            if (board_occupied(board, &stress_groups[loop].elements[element]) == 0)
+            {
+                printf("round %ld element (%ld, %ld) is not on the board\n", round, stress_groups[loop].elements[element].x, stress_groups[loop].elements[element].y);
+                return -1;
+            }
+            element++;
+        }
+        elements += stress_groups[loop].count;
+        loop++;
+    }
+    if (occupied != elements)
+    {
+        printf("round %ld has %ld cells occupied for %ld elements\n", round, occupied, elements);
+        return -1;
+    }
+    return 0;
+}
+
+/* groups adding and moving at once in a crowded region never lose or share a cell */
+static n_int board_test_concurrent(void)
+{
+    n_byte4 * board = board_new();
+    n_int result = 0;
+    n_int round = 0;
+    n_int loop = 0;
+
+    while (loop < STRESS_GROUPS)
+    {
+        stress_groups[loop].random[0] = (n_byte2)(0x5a5a + (loop * 7919));
+        stress_groups[loop].random[1] = (n_byte2)(0x1234 + (loop * 104729));
+        loop++;
+    }
+    execute_threads(STRESS_THREADS);
+    execute_group(&stress_add, board, stress_groups, STRESS_GROUPS, sizeof(stress_group));
+    result |= stress_check(board, 0);
+    while ((round < STRESS_ROUNDS) && (result == 0))
+    {
+        execute_group(&stress_move, board, stress_groups, STRESS_GROUPS, sizeof(stress_group));
+        round++;
+        result |= stress_check(board, round);
+    }
+    execute_close();
+    return result;
+}
+
+int main( int argc, const char *argv[] )
+{
+    n_int result = 0;
+
+    printf("----- board start ----- ----- -----\n");
+    result |= board_test_interior();
+    result |= board_test_edges();
+    result |= board_test_wrap();
+    result |= board_test_move();
+    result |= board_test_concurrent();
+    printf("----- board end   ----- ----- -----\n");
+
+    if (result)
+    {
+        exit(EXIT_FAILURE);
+    }
+    exit(EXIT_SUCCESS);
+}
@@ -0,0 +1,246 @@
+/****************************************************************
+
+ test_trace.c
+
+ =============================================================
+
+ Copyright 1996-2025 Tom Barbalet. All rights reserved.
+
+ Permission is hereby granted, free of charge, to any person
+ obtaining a copy of this software and associated documentation
+ files (the "Software"), to deal in the Software without
+ restriction, including without limitation the rights to use,
+ copy, modify, merge, publish, distribute, sublicense, and/or
+ sell copies of the Software, and to permit persons to whom the
+ Software is furnished to do so, subject to the following
+ conditions:
+
+ The above copyright notice and this permission notice shall be
+ included in all copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ OTHER DEALINGS IN THE SOFTWARE.
+
+ This software is a continuing work of Tom Barbalet, begun on
+ 13 June 1996. No apes or cats were harmed in the writing of
+ this software.
+ ****************************************************************/
+
+
+/* Golden trace harness. Each shipped scenario is run for TRACE_CYCLES and
+   the digest of the battle and of each unit, see engine_digest, is compared
+   cycle by cycle with the trace recorded in trace_<name>.txt. The first
+   cycle and unit to differ are reported. With --record the traces are
+   written instead, for when a change to the outcome is intended. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "toolkit.h"
+#include "battle.h"
+
+#define TRACE_CYCLES    (400)
+#define TRACE_LINE      (4096)
+
+typedef struct {
+    n_constant_string name;
+    n_constant_string file_name;    /* NOTHING for the conditions in engine.c */
+    n_uint            seed;
+    n_byte            deterministic;
+    n_byte            threads;
+    n_byte            move_method;
+    n_byte            sort_interval;
+} trace_scenario;
+
+/* Scenarios of the same name share a trace, which the last records. On one
+   thread MOVE_CONCURRENT claims the cells board_move would fill. */
+static const trace_scenario trace_scenarios[] = {
+    {"embedded",      NOTHING,             0,         0, 1, MOVE_SERIAL,  0},
+    {"battle",        "../battle.json",     1,         0, 1, MOVE_SERIAL,  0},
+    {"battle",        "../battle.json",     1,         0, 1, MOVE_CONCURRENT, 0},
+    {"deterministic", "../battle.json",     4242,      1, 3, MOVE_SERIAL,  0},
+    {"propose",       "../battle.json",     9,         1, 1, MOVE_PROPOSE, 0},
+    {"propose",       "../battle.json",     9,         1, 4, MOVE_PROPOSE, 0},
+    {"sort",          "../battle.json",     7,         1, 1, MOVE_SERIAL,  8},
+    {"sort",          "../battle.json",     7,         1, 4, MOVE_SERIAL,  8}
+};
+
+static n_battle trace_battle;
+
+// A line of the trace, the cycle, the battle's digest and each unit's digest
+static void trace_line(n_battle *battle, n_string line) {
+    n_byte2 loop = 0;
+    n_int position = sprintf(line, "%ld %016llx", battle->count, engine_digest(battle));
+    while ((loop < battle->number_units) && (position < (TRACE_LINE - 32))) {
+        position += sprintf(&line[position], " %016llx", engine_digest_unit(battle, &battle->units[loop]));
+        loop++;
+    }
+}
+
+// The first unit whose digest differs between two lines, -1 when none does
+static n_int trace_unit(n_string line, n_string golden) {
+    n_int unit = -1;
+    n_string end_line, end_golden;
+
+    (void)strtoul(line, &line, 10);
+    (void)strtoul(golden, &golden, 10);
+    (void)strtoull(line, &line, 16);
+    (void)strtoull(golden, &golden, 16);
+    while ((*line != 0) && (*line != '\n')) {
+        n_byte8 value = strtoull(line, &end_line, 16);
+        n_byte8 golden_value = strtoull(golden, &end_golden, 16);
+        unit++;
+        if ((end_line == line) || (value != golden_value)) {
+            return unit;
+        }
+        line = end_line;
+        golden = end_golden;
+    }
+    return -1;
+}
+
+// Start a scenario, returns -1 on error
+static n_int trace_start(const trace_scenario *scenario) {
+    n_file *file_json;
+    n_int result;
+
+    trace_battle.quiet = 1;
+    (void)engine_init(&trace_battle, scenario->seed);
+    trace_battle.game_vars.move_method = scenario->move_method;
+    trace_battle.game_vars.sort_interval = scenario->sort_interval;
+    if (scenario->file_name) {
+        file_json = engine_conditions_file(&trace_battle, scenario->file_name);
+        if (file_json == NOTHING) {
+            printf("%s not read\n", scenario->file_name);
+            return -1;
+        }
+        result = engine_start(&trace_battle, file_json, scenario->seed);
+        io_file_free(&file_json);
+        if (result != 0) {
+            return -1;
+        }
+    }
+    trace_battle.game_vars.deterministic = scenario->deterministic;
+    trace_battle.game_vars.threads = scenario->threads;
+    return 0;
+}
+
+// Sort every unit once more, checking each combatant's formation slot moves
+// with it, returns -1 on a difference or error
+static n_int trace_slots(n_battle *battle) {
+    n_uint unit = 0;
+
+    while (unit < battle->number_units) {
+        n_unit *un = &battle->units[unit++];
+        n_vect2 *before;
+        n_index loop = 0;
+
+        if (un->living_count < 2) {
+            continue;
+        }
+        before = (n_vect2 *)malloc(sizeof(n_vect2) * un->number_combatants);
+        if (before == NOTHING) {
+            return -1;
+        }
+        while (loop < un->number_combatants) {
+            (void)battle_formation_slot(un, loop, &before[loop]);
+            loop++;
+        }
+        battle_sort(battle, un);
+        loop = 0;
+        while (loop < un->number_combatants) {
+            n_vect2 after;
+            if ((battle_formation_slot(un, battle->sort_remap[loop], &after) == 0) ||
+                (after.x != before[loop].x) || (after.y != before[loop].y)) {
+                printf("combatant %d of unit %ld left its slot in the sort\n", (int)loop, unit - 1);
+                free(before);
+                return -1;
+            }
+            loop++;
+        }
+        free(before);
+    }
+    return 0;
+}
+
+// Run a scenario, writing or checking its trace, returns -1 on a difference or error
+static n_int trace_run(const trace_scenario *scenario, n_byte record) {
+    n_char file_name[64];
+    n_char line[TRACE_LINE];
+    n_char golden[TRACE_LINE];
+    FILE *trace;
+    n_int cycles = 0;
+    n_int result = 0;
+
+    sprintf(file_name, "trace_%s.txt", scenario->name);
+    trace = fopen(file_name, record ? "w" : "r");
+    if (trace == NOTHING) {
+        printf("%s not opened\n", file_name);
+        return -1;
+    }
+    if (trace_start(scenario) != 0) {
+        fclose(trace);
+        return -1;
+    }
+    while (result == 0) {
+        trace_line(&trace_battle, line);
+        if (record) {
+            fprintf(trace, "%s\n", line);
+        } else if (fgets(golden, TRACE_LINE, trace) == NOTHING) {
+            printf("%s runs past its trace at cycle %ld\n", scenario->name, trace_battle.count);
+            result = -1;
+        } else if (strncmp(line, golden, strlen(line)) != 0) {
+            n_int unit = trace_unit(line, golden);
+            if (unit < 0) {
+                printf("%s diverges at cycle %ld in the random state or cycle count\n", scenario->name, trace_battle.count);
+            } else {
+                printf("%s diverges at cycle %ld, first at unit %ld\n", scenario->name, trace_battle.count, unit);
+            }
+            result = -1;
+        }
+        if ((result != 0) || (cycles == TRACE_CYCLES) || engine_update(&trace_battle)) {
+            break;
+        }
+        cycles++;
+    }
+    if ((result == 0) && (record == 0) && (fgets(golden, TRACE_LINE, trace) != NOTHING)) {
+        printf("%s ends at cycle %ld before its trace\n", scenario->name, trace_battle.count);
+        result = -1;
+    }
+    if ((result == 0) && (scenario->sort_interval != 0)) {
+        result = trace_slots(&trace_battle);
+    }
+    fclose(trace);
+    engine_exit(&trace_battle);
+    if (result == 0) {
+        printf("%s %s, %ld cycles on %d threads\n", scenario->name, record ? "recorded" : "matches", cycles, scenario->threads);
+    }
+    return result;
+}
+
+int main( int argc, const char *argv[] )
+{
+    n_byte record = (argc > 1) && (strcmp(argv[1], "--record") == 0);
+    n_int result = 0;
+    n_uint loop = 0;
+
+    printf("----- trace start ----- ----- -----\n");
+    while (loop < (sizeof(trace_scenarios) / sizeof(trace_scenarios[0]))) {
+        result |= trace_run(&trace_scenarios[loop++], record);
+    }
+    execute_close();
+    printf("----- trace end   ----- ----- -----\n");
+
+    if (result)
+    {
+        exit(EXIT_FAILURE);
+    }
+    exit(EXIT_SUCCESS);
+}
@@ -0,0 +1,82 @@
+#!/bin/bash
+#	test_trace.sh
+#
+#	=============================================================
+#
+#   Copyright 1996-2025 Tom Barbalet. All rights reserved.
+#
+#   Permission is hereby granted, free of charge, to any person
+#   obtaining a copy of this software and associated documentation
+#   files (the "Software"), to deal in the Software without
+#   restriction, including without limitation the rights to use,
+#   copy, modify, merge, publish, distribute, sublicense, and/or
+#   sell copies of the Software, and to permit persons to whom the
+#   Software is furnished to do so, subject to the following
+#   conditions:
+#
+#   The above copyright notice and this permission notice shall be
+#	included in all copies or substantial portions of the Software.
+#
+#   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+#   EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+#   OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+#   NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+#   HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+#   WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+#   FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+#   OTHER DEALINGS IN THE SOFTWARE.
+#
+#   This software is a continuing work of Tom Barbalet, begun on
+#   13 June 1996. No apes or cats were harmed in the writing of
+#   this software.
+
+# --record writes the golden traces instead of checking them
+
+if [ $# -ge 1 -a "$1" == "--debug" ]
+then
+    CFLAGS=-g
+    shift
+else
+    CFLAGS=-O2
+fi
+
+gcc ${CFLAGS} -I../../ds-apesdk -I../../ds-apesdk/toolkit -I.. ../../ds-apesdk/toolkit/*.c ../*.c test_trace.c -o test_trace -lm -lpthread -w
+if [ $? -ne 0 ]
+then
+exit 1
+fi
+
+./test_trace "$@"
+if [ $? -ne 0 ]
+then
+rm test_trace
+exit 1
+fi
+
+rm test_trace
+
+# the combatant layouts and index widths share the traces, so the others are checked too,
+# as is a build with the asserts and the cross-checks they enable
+
+if [ $# -ge 1 -a "$1" == "--record" ]
+then
+exit 0
+fi
+
+for BUILD in COMBATANT_AOS COMBATANT_COMPACT BATTLE_INDEX_BITS=32 SIMULATED_APE_ASSERT_ON
+do
+    gcc ${CFLAGS} -D${BUILD} -I../../ds-apesdk -I../../ds-apesdk/toolkit -I.. ../../ds-apesdk/toolkit/*.c ../*.c test_trace.c -o test_trace -lm -lpthread -w
+    if [ $? -ne 0 ]
+    then
+    exit 1
+    fi
+
+    ./test_trace "$@"
+    if [ $? -ne 0 ]
+    then
+    rm test_trace
+    exit 1
+    fi
+
+    rm test_trace
+done
@@ -57,11 +57,11 @@ void draw_dpy(n_double dpy);
 void draw_dpz(n_double dpz);
 void draw_render(n_byte *value);
 void draw_combatant(n_combatant *comb, n_general_variables *gvar, void *values);
-void draw_cycle(n_unit *un, n_general_variables *gvar);
+void draw_cycle(n_battle *battle, n_unit *un);
 void draw_point(n_int px, n_int py);
 void draw_line(n_int px1, n_int py1, n_int px2, n_int py2);
 void draw_rectangle(n_int px1, n_int py1, n_int px2, n_int py2);
-void draw_engine(n_byte *value);
+void draw_engine(n_battle *battle, n_byte *value);
 
 // Initialize drawing (currently empty)
 void draw_init(void) {
@@ -255,10 +255,10 @@ void draw_combatant(n_combatant *comb, n_general_variables *gvar, void *values)
 }
 
 // Cycle through units and draw them
-void draw_cycle(n_unit *un, n_general_variables *gvar) {
+void draw_cycle(n_battle *battle, n_unit *un) {
     color = un->alignment;          // Set color based on unit alignment
     unit_selected = un->selected;   // Set selection state
-    combatant_loop(&draw_combatant, un, gvar, NOTHING);  // Loop through combatants
+    combatant_loop_living(&draw_combatant, un, &battle->game_vars, NOTHING);  // Loop through living combatants
 }
 
 // Draw a point on the screen
@@ -306,12 +306,13 @@ void draw_rectangle(n_int px1, n_int py1, n_int px2, n_int py2) {
 }
 
 // Main drawing engine
-void draw_engine(n_byte *value) {
+void draw_engine(n_battle *battle, n_byte *value) {
     n_vect2 start, end;
     n_byte2 number_units;
-    n_unit *units = engine_units(&number_units);  // Get units from engine
+    n_unit *units = engine_units(battle, &number_units);  // Get units from engine
 
-    battle_loop(&draw_cycle, units, number_units, NOTHING);  // Draw units
+    engine_profile_begin(battle, PROFILE_DRAW);  // Time the drawing when profiling
+    battle_loop(&draw_cycle, battle, units, number_units);  // Draw units
 
     engine_square_dimensions(&start, &end);  // Get dimensions
 
@@ -320,4 +321,5 @@ void draw_engine(n_byte *value) {
         draw_rectangle(start.x, start.y, end.x, end.y);
     }
     draw_render(value);  // Render the final output
+    engine_profile_end(battle);
 }
@@ -39,6 +39,8 @@
 
 static n_int simulation_started = 0;
 
+static n_battle shared_battle;
+
 static n_byte *outputBuffer = 0L;
 static n_byte *outputBufferOld = 0L;
 static n_int outputBufferMax = -1;
@@ -69,7 +71,7 @@ void shared_dimensions(n_int *dimensions) {
 
 shared_cycle_state shared_cycle(n_uint ticks, n_int fIdentification) {
     if (simulation_started) {
-        if (engine_update()) {
+        if (engine_update(&shared_battle)) {
             return SHARED_CYCLE_QUIT;
         }
     }
@@ -77,14 +79,15 @@ shared_cycle_state shared_cycle(n_uint ticks, n_int fIdentification) {
 }
 
 n_int shared_init(n_int view, n_uint random) {
-    if (engine_init(random)) {
+    if (engine_init(&shared_battle, random)) {
         simulation_started = 1;
     }
     return 0;
 }
 
 void shared_close(void) {
-    engine_exit();
+    engine_exit(&shared_battle);
+    execute_close();
 }
 
 void shared_delta(n_double delta_x, n_double delta_y, n_int wwind) {
@@ -104,7 +107,7 @@ n_int key_pressed = -1;
 
 void shared_keyReceived(n_int value, n_int fIdentification) {
     if (value != key_pressed) {
-        engine_key_received(value);
+        engine_key_received(&shared_battle, value);
     }
     key_pressed = value;
 }
@@ -122,7 +125,7 @@ void shared_mouseReceived(n_double valX, n_double valY, n_int fIdentification) {
 }
 
 void shared_mouseUp(void) {
-    engine_mouse_up();
+    engine_mouse_up(&shared_battle);
 }
 
 void shared_about(void) {
@@ -146,7 +149,7 @@ n_byte *shared_legacy_draw(n_byte fIdentification, n_int dim_x, n_int dim_y) {
     n_byte *outputBuffer = shared_output_buffer(dim_x, dim_y);
 
     if (simulation_started) {
-        draw_engine(outputBuffer);
+        draw_engine(&shared_battle, outputBuffer);
     }
     return outputBuffer;
 }
@@ -155,23 +158,23 @@ n_byte *shared_draw(n_int fIdentification, n_int dim_x, n_int dim_y, n_byte chan
     n_byte *outputBuffer = shared_output_buffer(dim_x, dim_y);
 
     if (simulation_started) {
-        draw_engine(outputBuffer);
+        draw_engine(&shared_battle, outputBuffer);
     }
     return outputBuffer;
 }
 
 n_int shared_new(n_uint seed) {
-    engine_new();
+    engine_new(&shared_battle);
     return 0;
 }
 
 n_int shared_new_agents(n_uint seed) {
-    engine_new();
+    engine_new(&shared_battle);
     return 0;
 }
 
 n_byte shared_openFileName(n_constant_string cStringFileName, n_int isScript) {
-    if (engine_conditions(engine_conditions_file(cStringFileName)) == 0) {
+    if (engine_conditions(&shared_battle, engine_conditions_file(&shared_battle, cStringFileName)) == 0) {
         simulation_started = 1;
         return 1;
     }